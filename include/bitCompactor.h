@@ -29,17 +29,41 @@
 
 #include "utils/utils.h"
 #include "utils/logger.h"
+#include "bitStream.h"
 
 namespace btc27
 {
 #define BTC27_NUMALGO                 8
 #define BTC27_NUM4KALGO               2
 
+// Compression levels, see btcmpctr_compress_wrap_args_t::level
+#define BTC27_LEVEL_FAST              1
+#define BTC27_LEVEL_MAX               3
+
+// Bitstream layouts, see btcmpctr_compress_wrap_args_t::streamVersion
+#define BTC27_STREAM_V0               0 // Compressed 4K blocks have no dual encode field
+#define BTC27_STREAM_V1               1 // Compressed 4K blocks carry the dual encode field with dual encoding enabled
+
 #define BTC27_MAX_DECOMPRESS_FACTOR   5
 #define BTC27_MAX_COMPRESS_FACTOR     2
 
 #define BTC27_FILENAME_SIZE           256
 
+// btcmpctr_block_info_t::algo of an uncompressed block, and flag added to
+// the Algo of a dual encoded block.
+#define BTC27_BLOCK_UNCMPRSD          16
+#define BTC27_BLOCK_DUAL              0x80
+
+// Readable bytes required past srcLen by DecompressPaddedWrap
+#define BTC27_DECODE_PADDING          BTC27_READER_PADDING
+
+// DecompressPaddedWrap status
+#define BTC27_DECODE_OK               0
+#define BTC27_DECODE_ERR_NULL         1 // Null buffer
+#define BTC27_DECODE_ERR_DST_SIZE     2 // Decompressed data larger than dstLen
+#define BTC27_DECODE_ERR_TRUNCATED    3 // A block runs past srcLen
+#define BTC27_DECODE_ERR_MALFORMED    4 // A block header is inconsistent
+
 class BitCompactor
 {
 public:
@@ -55,8 +79,38 @@ public:
         int dual_encode_en{1};  // Enable dual encoding mode. 0 -> disabled, 1 -> enabled
         int bypass_en{0};       // When set to 1, the compressor will treat all blocks as bypass.
         int minFixedBitLn{3};   // Set minimum fixed-length symbol size in bits (0..7, default 3)
+        int level{BTC27_LEVEL_MAX}; // Compression level. 1 -> MINPRDCT/NOPRDCT/NOSPRDCT only, 2 -> all predictors,
+                                    // 3 -> exhaustive search (default). Below 3 dual encoding is only tried with
+                                    // NOPRDCT, so sparse tensors whose non-zero values are small, or which are not
+                                    // zero dominated, can compress much less. Every level decodes with DecompressWrap.
+        int adaptive_en{0};     // Enable adaptive predictor pruning, levels > 1. 0 -> disabled, 1 -> enabled
+        int adaptiveMaxLoss{1}; // Adaptive predictor pruning: bound on the estimated ratio loss, in percent
+        int streamVersion{BTC27_STREAM_V0}; // Bitstream layout, BTC27_STREAM_V0 (default) or BTC27_STREAM_V1.
+                                            // A stream decodes only with the version it was written with.
     } btcmpctr_compress_wrap_args_t;
 
+    // Block of a compressed stream, see ScanWrap
+    typedef struct btcmpctr_block_info_s
+    {
+        uint64_t bitOffset; // Offset of the block header in the compressed buffer, in bits
+        uint16_t blkSize;   // Decompressed size in bytes
+        uint8_t  algo;      // Header Algo, BTC27_BLOCK_UNCMPRSD if uncompressed. With BTC27_BLOCK_DUAL if dual encoded.
+        uint8_t  bitln;     // Bits per symbol, 1..8
+    } btcmpctr_block_info_t;
+
+    // Dequantization applied by DecompressDequantWrap. Element i of the
+    // decompressed tensor belongs to channel (i / channelStride) % numChannels
+    // and gives (q - zeroPoint[channel]) * scale[channel].
+    typedef struct btcmpctr_dequant_args_s
+    {
+        const float* scale{nullptr};     // numChannels scales
+        const float* zeroPoint{nullptr}; // numChannels zero points, nullptr for all 0
+        unsigned int numChannels{1};
+        unsigned int channelStride{1};   // Consecutive elements of a channel, e.g. IC*KH*KW for per output
+                                         // channel OIHW weights, 1 for a channel last layout
+        int          isSigned{1};        // Elements q are int8 when 1, uint8 when 0
+    } btcmpctr_dequant_args_t;
+
     BitCompactor();
 
     BitCompactor(const BitCompactor &) = delete;
@@ -81,6 +135,42 @@ public:
                         const btcmpctr_compress_wrap_args_t& args   // input decompression configuration args
                         );
 
+    // BTC decoding/decompression of a buffer followed by BTC27_DECODE_PADDING
+    // readable bytes, whose content does not matter. The blocks are decoded
+    // with unchecked loads up to the last few, which are decoded like
+    // DecompressWrap. Malformed streams are never read or written out of bounds.
+    //  return: BTC27_DECODE_OK - decompression success;
+    //          BTC27_DECODE_ERR_* - decompression fail, dstLen holds the bytes decompressed until then;
+    int  DecompressPaddedWrap(const unsigned char* src,           // input compressed buffer data, followed by BTC27_DECODE_PADDING bytes
+                              unsigned int         srcLen,        // input compressed buffer size, without the padding
+                              unsigned char*       dst,           // output decompressed buffer data
+                              unsigned int&        dstLen,        // input decompressed buffer size bound
+                                                                  // output decompressed buffer size result
+                              const btcmpctr_compress_wrap_args_t& args // input decompression configuration args
+                             );
+
+    // BTC decoding/decompression of a quantized tensor, dequantized to fp32 or
+    // fp16 (IEEE half bits, rounded to nearest even) as it is decompressed.
+    // Every block is decompressed to a scratch buffer and dequantized from
+    // there, the int8 tensor is never stored.
+    //  return: 1 - decompression success;
+    //          0 - decompression fail;
+    int  DecompressDequantWrap(const unsigned char*           src,     // input compressed buffer data
+                               unsigned int                   srcLen,  // input compressed buffer size
+                               float*                         dst,     // output dequantized tensor
+                               unsigned int&                  dstLen,  // input dequantized tensor size bound, in elements
+                                                                       // output dequantized tensor size result, in elements
+                               const btcmpctr_dequant_args_t& dequant, // input dequantization args
+                               const btcmpctr_compress_wrap_args_t& args // input decompression configuration args
+                              );
+    int  DecompressDequantWrap(const unsigned char*           src,
+                               unsigned int                   srcLen,
+                               uint16_t*                      dst,     // output dequantized tensor, fp16
+                               unsigned int&                  dstLen,
+                               const btcmpctr_dequant_args_t& dequant,
+                               const btcmpctr_compress_wrap_args_t& args
+                              );
+
     // BTC encoding/compression
     //  return: 1 - compression success;
     //          0 - compression fail;
@@ -92,6 +182,20 @@ public:
                         const btcmpctr_compress_wrap_args_t& args   // input compression configuration args
                         );
 
+    // BTC stream scan. Walks the block headers and skips the payloads, giving
+    // the decompressed size and the block map without decompressing.
+    //  return: 1 - scan success;
+    //          0 - scan fail, a block runs past the end of the buffer;
+    int  ScanWrap(      const unsigned char*        src,            // input compressed buffer data
+                        unsigned int                srcLen,         // input compressed buffer size
+                        unsigned int&               dstLen,         // output decompressed buffer size result
+                        btcmpctr_block_info_t*      blocks,         // output block map, may be nullptr
+                        unsigned int&               numBlocks,      // input number of entries in blocks
+                                                                    // output number of blocks in the stream, blocks
+                                                                    // holds the first ones if it is too small
+                        const btcmpctr_compress_wrap_args_t& args   // input decompression configuration args
+                        );
+
     // BTC compressed size bound calculation. Call before compression.
     //  return: Worst case compressed buffer size for given decompressed buffer size
     unsigned int GetCompressedSizeBound(unsigned int bufSize        // input decompressed buffer size
@@ -129,19 +233,62 @@ private:
         unsigned char*       residual; // Pre-Processed data to be inserted into the output stream.
                   int        blkSize;  // Current Block Size to work with.
                   int        minFixedBitLn;
+                  int        level;    // Compression level, see btcmpctr_compress_wrap_args_t.
+                  int        algoMask; // 64B Algo's evaluated by btcmpctr_ChooseAlgo64B, one bit per Algo index.
+                  int*       algoSize; // If set, compressed size of every evaluated 64B Algo.
                   int*       numSyms;  // Number of Symbols binned.
         unsigned char*       bitmap;   // bit map when replacing highest frequency symbol.
                   int*       numBytes; // Number of bytes in residual that is valid, when bitmap compressed.
     } btcmpctr_algo_args_t;
 
-    // Typedef of the Algo Function pointer.
-    typedef void (BitCompactor::*Algo)(btcmpctr_algo_args_t* algoArg);
+    // Typedefs of the compression/decompression engines specialized on the configuration flags.
+    typedef int (BitCompactor::*CompressEngine)(const unsigned char*                 src,
+                                                unsigned int                         srcLen,
+                                                unsigned char*                       dst,
+                                                unsigned int&                        dstLen,
+                                                const btcmpctr_compress_wrap_args_t& args);
+    typedef int (BitCompactor::*DecompressEngine)(const unsigned char* src,
+                                                  unsigned int         srcLen,
+                                                  unsigned char*       dst,
+                                                  unsigned int&        dstLen);
+    typedef int (BitCompactor::*ScanEngine)(const unsigned char*   src,
+                                            unsigned int           srcLen,
+                                            unsigned int&          dstLen,
+                                            btcmpctr_block_info_t* blocks,
+                                            unsigned int&          numBlocks);
+    typedef int (BitCompactor::*DecompressDequantEngine)(const unsigned char*           src,
+                                                         unsigned int                   srcLen,
+                                                         void*                          dst,
+                                                         int                            outType,
+                                                         unsigned int&                  dstLen,
+                                                         const btcmpctr_dequant_args_t& dequant);
+
+    // Decoding state of one compressed buffer, advanced a block at a time by
+    // btcmpctr_DecodeBlock.
+    template <int PADDED>
+    struct btcmpctr_decode_stream_s
+    {
+        BitReaderT<PADDED>   reader;
+        const unsigned char* src;
+        unsigned int         srcLen;
+        unsigned char*       dst;
+        unsigned int         dstLen;  // Decompressed size bound
+        unsigned int         dstCnt;  // Bytes decompressed so far
+        unsigned int         blkCnt;
+        unsigned char*       blkBuf;  // If set, every block is decompressed there instead of dst + dstCnt
+        // Per block scratch, kept in the stream rather than passed by pointer
+        // so that its stores are not taken as aliasing reader.
+        unsigned char        bytes_to_add[64];    // MAXSYMS4K, also the BINEXPPROC lookup table
+        unsigned char        bitmap[4096];        // BIGBLKSIZE
+        unsigned char        bitmapBytes[4096];   // BIGBLKSIZE
+    };
+    typedef btcmpctr_decode_stream_s<0> btcmpctr_decode_stream_t;
 
     // Struct defining the chosen Algorithm and its compressed size
     typedef struct btcmpctr_algo_choice_s
     {
-       // Pointer to the chosen Algo function
-       Algo chosenAlgo;
+       // Index of the chosen 64B or 4K Algo, BITC_ALG_NONE if none.
+       int  algoIdx;
        int  cmprsdSize;
        int  algoType; // 0 64B, 1 4K
        int  none; // None chosen, hence uncompressed.
@@ -150,15 +297,53 @@ private:
        int  dual_encode;
     } btcmpctr_algo_choice_t;
 
+    // Struct holding the statistics of a block shared by the predictor cost evaluation
+    typedef struct btcmpctr_blk_stats_s
+    {
+        int           blkSize;
+        unsigned char umin;          // Unsigned minimum
+        unsigned char umax;          // Unsigned maximum
+        signed char   smin;          // Signed minimum
+        signed char   smax;          // Signed maximum
+        int           sum;           // Signed sum
+        uint16_t      cumHist[257];  // Number of bytes < v, valid for v in [umin+1..umax]
+    } btcmpctr_blk_stats_t;
+
+    // Choice made for a constant 64B block and the output of its chosen Algo
+    typedef struct btcmpctr_const_blk_s
+    {
+        int                    valid;
+        btcmpctr_algo_choice_t choice;
+        unsigned char          bitln;
+        unsigned char          minimum;
+        unsigned char          residual;  // Residual of every byte
+        unsigned char          bitmap0;   // Dual bitmap of the first byte
+        unsigned char          bitmap1;   // Dual bitmap of the other bytes
+    } btcmpctr_const_blk_t;
+
+    // State of the adaptive predictor pruning
+    typedef struct btcmpctr_adapt_s
+    {
+        unsigned int wins[BTC27_NUMALGO]; // Recent wins of every 64B Algo
+        int          likelyMask;          // Algo's evaluated between full evaluations
+        int          sinceFull;           // Blocks since the last full evaluation
+        int          forceFull;           // Size regressed, fully evaluate the next block
+        int          numBlks;             // Blocks since the last decay
+        int          numFull;             // Full evaluations since the last decay
+        int          disabled;            // Pruning saved no work in the last decay period, every block is fully evaluated
+        int          avgSize;             // Running average of the fully evaluated block sizes
+        long long    lossBits;            // Sampled extra bits of the pruned choice over the full one
+        long long    sampledBits;         // Sampled bits of the full choice
+    } btcmpctr_adapt_t;
 
     // CompressWrap
-    Algo AlgoAry[BTC27_NUMALGO];
-    Algo AlgoAry4K[BTC27_NUM4KALGO];
-
-    // Declare Array of Algorithms
+    // Header overhead of the Algorithms
     int AlgoAryHeaderOverhead[BTC27_NUMALGO];
     int AlgoAryHeaderOverhead4K[BTC27_NUM4KALGO];
 
+    // Configuration the header overheads were built for, see btcmpctr_initAlgosAry. -1 if not built.
+    int mAlgoAryCfg;
+
     // Returns ceil(log2(i)), i = [0..256]
     const uint8_t mCeilLog2LUT[257] {
         0, 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
@@ -171,36 +356,37 @@ private:
         8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
         8};
 
+    // btcmpctr_compress_wrap_args_t::streamVersion of the current call
+    int mStreamVersion;
+
     // Debug support
     int mVerbosityLevel;
     std::stringstream mDebugStr;
 
-    unsigned char btcmpctr_insrt_byte( unsigned char  byte,
-                                       unsigned char  bitln,
-                                       unsigned int*  outBufLen,
-                                       unsigned char* outBuf,
-                                       unsigned char  state,
-                                       unsigned int*  accum,
-                                                int   flush
-                                     );
-
-    unsigned char btcmpctr_insrt_hdr(int chosenAlgo,
-                                     unsigned char  bitln,
-                                     unsigned int*  outBufLen,
-                                     unsigned char* outBuf,
-                                     unsigned char  state,
-                                     unsigned int*  accum,
-                                     unsigned char  eofr,
-                                     int            workingBlkSize,
-                                     int            mixedBlkSize,
-                                     int            align
-                                    );
+    void btcmpctr_insrt_hdr(BitWriter&     writer,
+                            int            chosenAlgo,
+                            unsigned char  bitln,
+                            unsigned char  eofr,
+                            int            workingBlkSize,
+                            int            mixedBlkSize,
+                            int            align
+                           );
+
+    void btcmpctr_insrt_bypass(BitWriter&           writer,
+                               const unsigned char* inAry,
+                               int                  bigBlkSize,
+                               int                  mixedBlkSize
+                              );
 
     void btcmpctr_calc_bitln(const unsigned char*   residual,
                              unsigned char*         bitln,
                              int                    blkSize,
                              int                    minFixedBitLn
                             );
+    void btcmpctr_calc_dual_cumsyms(const unsigned char* residual,
+                                             int   blkSize,
+                                             int*  cumSyms
+                                   );
     void btcmpctr_calc_dual_bitln(const unsigned char* residual,
                                         unsigned char* bitln,
                                                  int   blkSize,
@@ -211,44 +397,41 @@ private:
                              unsigned char*     residual,
                              int                blkSize
                             );
+    template <int BLK>
     void btcmpctr_minprdct(
                             btcmpctr_algo_args_t* algoArg
                           );
+    template <int BLK>
     void btcmpctr_minSprdct(
                              btcmpctr_algo_args_t* algoArg
                            );
+    template <int BLK>
     void btcmpctr_muprdct(
                             btcmpctr_algo_args_t* algoArg
                           );
+    template <int BLK>
     void btcmpctr_medprdct(
                             btcmpctr_algo_args_t* algoArg
                           );
+    template <int BLK>
     void btcmpctr_noprdct(
                             btcmpctr_algo_args_t* algoArg
                          );
+    template <int BLK>
     void btcmpctr_noSprdct(
                             btcmpctr_algo_args_t* algoArg
                          );
+    template <int BLK>
     void btcmpctr_binCmpctprdct(
                                 btcmpctr_algo_args_t* algoArg
                                );
+    template <int BLK>
     void btcmpctr_btMapprdct(
                                 btcmpctr_algo_args_t* algoArg
                             );
-    void btcmpctr_dummyprdct(
-                                btcmpctr_algo_args_t* algoArg
-                               );
-    void btcmpctr_xtrct_bits(
-                       const unsigned char* inBuf,
-                             unsigned  int* inBufLen,
-                             unsigned char* state,
-                             unsigned char* outByte,
-                             unsigned char  numBits
-                            );
-    unsigned char btcmpctr_xtrct_hdr(
-                               const unsigned char* inAry,
-                                     unsigned  int* inAryPtr,
-                                     unsigned char  state,
+    template <int MIXED, int DUAL, int PADDED>
+    void btcmpctr_xtrct_hdr(
+                                     BitReaderT<PADDED>& reader,
                                      unsigned char* cmp,
                                      unsigned char* eofr,
                                      unsigned char* algo,
@@ -258,53 +441,159 @@ private:
                                      unsigned char* numSyms,
                                      unsigned int*  numBytes,
                                      unsigned char* bitmap,
-                                              int   mixedBlkSize,
-                                              int   dual_encode_en,
                                      unsigned char*  dual_encode
                                     );
-    unsigned char btcmpctr_xtrct_bytes_wbitmap(
-                                         const unsigned char* inAry,
-                                               unsigned  int* inAryPtr,
-                                               unsigned char  state,
+    template <int PADDED>
+    void btcmpctr_xtrct_bytes_wbitmap(
+                                               BitReaderT<PADDED>& reader,
                                                unsigned char  bitln,
                                                unsigned char* outBuf, // Assume OutBuf is BLKSIZE
                                                          int  blkSize,
-                                               unsigned char* bitmap
+                                               unsigned char* bitmap,
+                                                         int  xfrm,
+                                         const unsigned char* xfrmArg
                                              );
-    unsigned char btcmpctr_xtrct_bytes(
-                                  const unsigned char* inAry,
-                                        unsigned  int* inAryPtr,
-                                        unsigned char  state,
+    template <int PADDED>
+    void btcmpctr_xtrct_bytes(
+                                        BitReaderT<PADDED>& reader,
                                         unsigned char  bitln,
                                         unsigned char* outBuf, // Assume OutBuf is BLKSIZE
                                                   int  blkSize,
-                                        unsigned char  mode16
+                                                  int  xfrm,
+                                  const unsigned char* xfrmArg
                                       );
-    void btcmpctr_tosigned(const unsigned char* inAry,
-                                 unsigned char* outBuf
-                          );
-    void btcmpctr_addByte(
-                    const unsigned char* data_to_add,
-                          unsigned char  mode16,
-                          unsigned char* outBuf
-                         );
 
 
+    void btcmpctr_runAlgo64B(int algoIdx, btcmpctr_algo_args_t* algoArg);
+
+    void btcmpctr_runAlgo4K(int algoIdx, btcmpctr_algo_args_t* algoArg);
+
     void btcmpctr_initAlgosAry(const btcmpctr_compress_wrap_args_t& args);
 
+    int btcmpctr_getCfgIdx(const btcmpctr_compress_wrap_args_t& args);
+
+    CompressEngine btcmpctr_getCompressEngine(const btcmpctr_compress_wrap_args_t& args);
+
+    DecompressEngine btcmpctr_getDecompressEngine(const btcmpctr_compress_wrap_args_t& args);
+
+    DecompressEngine btcmpctr_getDecompressPaddedEngine(const btcmpctr_compress_wrap_args_t& args);
+
+    DecompressDequantEngine btcmpctr_getDecompressDequantEngine(const btcmpctr_compress_wrap_args_t& args);
+
+    ScanEngine btcmpctr_getScanEngine(const btcmpctr_compress_wrap_args_t& args);
+
+    template <int MIXED, int DUAL, int BIN, int BTMAP>
+    int btcmpctr_CompressEngine(const unsigned char*                 src,
+                                unsigned int                         srcLen,
+                                unsigned char*                       dst,
+                                unsigned int&                        dstLen,
+                                const btcmpctr_compress_wrap_args_t& args
+                               );
+
+    template <int MIXED, int DUAL>
+    int btcmpctr_DecompressEngine(const unsigned char* src,
+                                  unsigned int         srcLen,
+                                  unsigned char*       dst,
+                                  unsigned int&        dstLen
+                                 );
+
+    template <int MIXED, int DUAL>
+    int btcmpctr_DecompressPaddedEngine(const unsigned char* src,
+                                        unsigned int         srcLen,
+                                        unsigned char*       dst,
+                                        unsigned int&        dstLen
+                                       );
+
+    template <int MIXED, int DUAL>
+    int btcmpctr_DecompressDequantEngine(const unsigned char*           src,
+                                         unsigned int                   srcLen,
+                                         void*                          dst,
+                                         int                            outType,
+                                         unsigned int&                  dstLen,
+                                         const btcmpctr_dequant_args_t& dequant
+                                        );
+
+    int btcmpctr_DecompressDequant(const unsigned char*                 src,
+                                   unsigned int                         srcLen,
+                                   void*                                dst,
+                                   int                                  outType,
+                                   unsigned int&                        dstLen,
+                                   const btcmpctr_dequant_args_t&       dequant,
+                                   const btcmpctr_compress_wrap_args_t& args
+                                  );
+
+    template <int PADDED>
+    void btcmpctr_openStream(btcmpctr_decode_stream_s<PADDED>* stream,
+                             const unsigned char*              src,
+                             unsigned int                      srcLen,
+                             unsigned char*                    dst,
+                             unsigned int                      dstLen
+                            );
+
+    template <int MIXED, int DUAL>
+    int btcmpctr_ScanEngine(const unsigned char*   src,
+                            unsigned int           srcLen,
+                            unsigned int&          dstLen,
+                            btcmpctr_block_info_t* blocks,
+                            unsigned int&          numBlocks
+                           );
+
+    // Decode the next block of stream.
+    //  return: BTC27_DECODE_OK - block decoded;
+    //          BTC27_DECODE_ERR_* - decompression fail;
+    template <int MIXED, int DUAL, int PADDED>
+    int btcmpctr_DecodeBlock(btcmpctr_decode_stream_s<PADDED>* stream);
+
     unsigned char btcmpctr_getAlgofrmIdx(int idx);
 
     unsigned char btcmpctr_get4KAlgofrmIdx(int idx);
 
-    btcmpctr_algo_choice_t btcmpctr_ChooseAlgo64B(btcmpctr_algo_args_t* algoArg,
-                                                                   int mixedBlkSize,
-                                                                   int dual_encode_en
-                                                );
+    void btcmpctr_calc_blk_stats(const unsigned char*  inAry,
+                                       int             blkSize,
+                                 btcmpctr_blk_stats_t* stats
+                                );
+
+    void btcmpctr_calc_cum_bitln(const btcmpctr_blk_stats_t* stats,
+                                       unsigned char         offset,
+                                       int                   sign,
+                                       int*                  cumSyms
+                                );
+
+    int btcmpctr_calc_dual_cost(const int*           cumSyms,
+                                      int            blkSize,
+                                      unsigned char* bitln
+                               );
+
+    // The output of the chosen Algo is left in algoArg.
+    template <int MIXED, int DUAL>
+    btcmpctr_algo_choice_t btcmpctr_ChooseAlgo64B(btcmpctr_algo_args_t* algoArg);
+
+    btcmpctr_algo_choice_t btcmpctr_ChooseAlgoFast64B(btcmpctr_algo_args_t* algoArg, int mixedBlkSize, int dual);
+
+    template <int MIXED, int DUAL>
+    btcmpctr_algo_choice_t btcmpctr_ChooseAlgoAdapt64B(btcmpctr_algo_args_t* algoArg,
+                                                       btcmpctr_adapt_t*     adapt,
+                                                       int                   maxLoss
+                                                      );
+
+    void btcmpctr_adapt_init(btcmpctr_adapt_t* adapt);
+
+    void btcmpctr_adapt_update(btcmpctr_adapt_t*             adapt,
+                               const btcmpctr_algo_choice_t& choice,
+                               const int*                    algoSize,
+                               int                           noneSize
+                              );
+
+    template <int MIXED, int DUAL>
+    btcmpctr_algo_choice_t btcmpctr_ChooseAlgoConst64B(btcmpctr_algo_args_t* algoArg,
+                                                       btcmpctr_const_blk_t* constBlk
+                                                     );
 
+    template <int BIN, int BTMAP>
     btcmpctr_algo_choice_t btcmpctr_ChooseAlgo4K(btcmpctr_algo_args_t* algoArg,
                                                                   int mixedBlkSize
                                                );
 
-    elem_type getMedianNaive(elem_type arr[], unsigned int blkSize);
+    elem_type getMedianHist(const btcmpctr_blk_stats_t* stats);
 };
 } // namespace btc27
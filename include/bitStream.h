@@ -0,0 +1,429 @@
+//
+// Copyright (C) 2023 Intel Corporation
+// SPDX-License-Identifier: Apache 2.0
+//
+
+//
+
+// Bit level stream helpers used by the BitCompactor model.
+// The BitCompactor bitstream is packed LSB first: the first field inserted
+// occupies the least significant bits of the first byte.
+//
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+namespace btc27
+{
+
+// Size of the output buffer given to btcmpctr_pack64B. The kernels store
+// whole 64 bit lanes, so up to 8 bytes past bitln*8 may be written.
+#define BTC27_PACK64B_BUFSIZE 72
+
+// Pack 64 symbols of bitln (1..8) bits each into bitln*8 bytes, LSB first.
+// Only the bitln LSBs of each symbol are kept.
+void btcmpctr_pack64B(const unsigned char* syms,
+                      unsigned int         bitln,
+                      unsigned char*       outBuf // BTC27_PACK64B_BUFSIZE bytes
+                     );
+
+// Pack 64 byte-per-bit map entries (bit 0 of each byte) into a 64 bit word.
+uint64_t btcmpctr_packBitmap64B(const unsigned char* bitmap);
+
+// Expand a 64 bit word into a byte-per-bit map of 64 entries, 0 or 1.
+// Inverse of btcmpctr_packBitmap64B.
+void btcmpctr_unpackBitmap64B(uint64_t word, unsigned char* bitmap);
+
+// Size of the input buffer given to btcmpctr_unpack64B. The kernels load
+// whole 64 bit lanes, so up to 72 bytes may be read from a block holding
+// only bitln*8 significant bytes.
+#define BTC27_UNPACK64B_BUFSIZE 72
+
+// Unpack bitln*8 bytes (bitln 1..8, LSB first) into 64 symbols of one byte
+// each. Inverse of btcmpctr_pack64B.
+void btcmpctr_unpack64B(const unsigned char* inBuf, // BTC27_UNPACK64B_BUFSIZE bytes
+                        unsigned int         bitln,
+                        unsigned char*       syms
+                       );
+
+// Transforms applied by btcmpctr_unpackXfrm64B to every symbol while it is
+// still in registers, undoing the block pre-processing.
+#define BTC27_XFRM_NONE        0
+#define BTC27_XFRM_LOOKUP      1 // xfrmArg[sym], BINEXPPROC
+#define BTC27_XFRM_SIGNED      2 // Inverse of the sign shift, SIGNSHFTPROC
+#define BTC27_XFRM_ADD         3 // sym + xfrmArg[0], ADDPROC
+#define BTC27_XFRM_SIGNED_ADD  4 // Both of the above, SIGNSHFTADDPROC
+#define BTC27_NUMXFRM          5
+
+// Lookup tables have BTC27_LOOKUP_SIZE entries, indexed by up to
+// BTC27_LOOKUP_MAXBITLN bits.
+#define BTC27_LOOKUP_SIZE      64
+#define BTC27_LOOKUP_MAXBITLN  6
+
+// Transform of a single symbol (< 256).
+inline unsigned char btcmpctr_xfrmSym(unsigned int sym, int xfrm, const unsigned char* xfrmArg)
+{
+    switch(xfrm) {
+        case BTC27_XFRM_LOOKUP:     return xfrmArg[sym];
+        case BTC27_XFRM_SIGNED:     return (unsigned char)((sym >> 1) ^ (0u - (sym & 1)));
+        case BTC27_XFRM_ADD:        return (unsigned char)(sym + xfrmArg[0]);
+        case BTC27_XFRM_SIGNED_ADD: return (unsigned char)(((sym >> 1) ^ (0u - (sym & 1))) + xfrmArg[0]);
+        default:                    return (unsigned char)sym;
+    }
+}
+
+// btcmpctr_unpack64B followed by syms[i] = btcmpctr_xfrmSym(syms[i], ...),
+// in a single pass. bitln is 1..BTC27_LOOKUP_MAXBITLN for BTC27_XFRM_LOOKUP.
+void btcmpctr_unpackXfrm64B(const unsigned char* inBuf, // BTC27_UNPACK64B_BUFSIZE bytes
+                            unsigned int         bitln,
+                            int                  xfrm,
+                            const unsigned char* xfrmArg,
+                            unsigned char*       syms
+                           );
+
+// Scalar reference versions of the kernels above. The SIMD variant used by
+// the kernels above is selected at runtime, see cpuDispatch.h.
+void btcmpctr_pack64B_scalar(const unsigned char* syms,
+                             unsigned int         bitln,
+                             unsigned char*       outBuf
+                            );
+uint64_t btcmpctr_packBitmap64B_scalar(const unsigned char* bitmap);
+void btcmpctr_unpackBitmap64B_scalar(uint64_t word, unsigned char* bitmap);
+void btcmpctr_unpackXfrm64B_scalar(const unsigned char* inBuf,
+                                   unsigned int         bitln,
+                                   int                  xfrm,
+                                   const unsigned char* xfrmArg,
+                                   unsigned char*       syms
+                                  );
+
+class BitWriter
+{
+public:
+
+    explicit BitWriter(unsigned char* outBuf) :
+        mOutBuf(outBuf), mOutBufLen(0), mAccum(0), mState(0)
+    {
+    }
+
+    BitWriter(const BitWriter &) = delete;
+    BitWriter& operator= (const BitWriter &) = delete;
+
+    // Insert the numBits (0..32) LSBs of value.
+    inline void insert(uint32_t value, unsigned int numBits)
+    {
+        uint64_t field = value & (uint32_t)((1ULL << numBits) - 1);
+        mAccum |= field << mState;
+        mState += numBits;
+        if (mState >= 64) {
+            storeWord(mAccum);
+            mState -= 64;
+            // Bits of field which did not fit in the full word.
+            // numBits <= 32, hence the shift is always < 64.
+            mAccum = field >> (numBits - mState);
+        }
+    }
+
+    // Insert a complete 64 bit word.
+    inline void insertWord(uint64_t word)
+    {
+        if (mState == 0) {
+            storeWord(word);
+        } else {
+            storeWord(mAccum | (word << mState));
+            mAccum = word >> (64 - mState);
+        }
+    }
+
+    // Insert count bytes, 8 at a time as 64 bit words.
+    inline void insertBytes(const unsigned char* bytes, int count)
+    {
+        for(; count >= 8; count -= 8, bytes += 8) {
+            uint64_t word;
+            memcpy(&word, bytes, sizeof(word));
+            insertWord(word);
+        }
+        for(int i = 0; i < count; i++) {
+            insert(bytes[i], 8);
+        }
+    }
+
+    // Insert count fixed-width fields of bitln (0..8) bits each.
+    inline void insertRun(const unsigned char* syms, int count, unsigned int bitln)
+    {
+        if (bitln == 0) {
+            return;
+        } else if (bitln == 8) {
+            insertBytes(syms, count);
+            return;
+        }
+        // Whole 64 symbol blocks are packed to exactly bitln words.
+        unsigned char packed[BTC27_PACK64B_BUFSIZE];
+        for(; count >= 64; count -= 64, syms += 64) {
+            btcmpctr_pack64B(syms, bitln, packed);
+            for(unsigned int w = 0; w < bitln; w++) {
+                uint64_t word;
+                memcpy(&word, packed + 8*w, sizeof(word));
+                insertWord(word);
+            }
+        }
+        for(int i = 0; i < count; i++) {
+            insert(syms[i], bitln);
+        }
+    }
+
+    // Insert a byte-per-bit map (bit 0 of each entry) as count single bits.
+    inline void insertBitmap(const unsigned char* bitmap, int count)
+    {
+        for(; count >= 64; count -= 64, bitmap += 64) {
+            insertWord(btcmpctr_packBitmap64B(bitmap));
+        }
+        for(int i = 0; i < count; i++) {
+            insert(bitmap[i], 1);
+        }
+    }
+
+    // Pad with zero bits up to the next byte boundary.
+    inline void alignToByte()
+    {
+        insert(0, (8 - (mState & 7)) & 7);
+    }
+
+    // Write out the partially filled accumulator. Leaves the stream byte aligned.
+    inline void flush()
+    {
+        unsigned int numBytes = (mState + 7) >> 3;
+        for(unsigned int i = 0; i < numBytes; i++) {
+            mOutBuf[mOutBufLen + i] = (unsigned char)(mAccum >> (8*i));
+        }
+        mOutBufLen += numBytes;
+        mAccum = 0;
+        mState = 0;
+    }
+
+    // Number of bits pending in the accumulator.
+    inline unsigned int state() const { return mState; }
+
+    // Number of bytes written to the output buffer so far.
+    inline unsigned int length() const { return mOutBufLen; }
+
+    // Number of bytes occupied once the accumulator is flushed.
+    inline unsigned int bytesInBuf() const { return mOutBufLen + ((mState + 7) >> 3); }
+
+private:
+
+    inline void storeWord(uint64_t word)
+    {
+        // Stream is little endian, matching the 32 bit stores of the original model.
+        memcpy(mOutBuf + mOutBufLen, &word, sizeof(word));
+        mOutBufLen += sizeof(word);
+    }
+
+    unsigned char* mOutBuf;
+    unsigned int   mOutBufLen;
+    uint64_t       mAccum;
+    unsigned int   mState;
+};
+
+// Bytes past inBufLen that a PADDED BitReaderT may load: a refill loads 8
+// bytes and an in place 64 symbol block BTC27_UNPACK64B_BUFSIZE bytes, from
+// positions below inBufLen.
+#define BTC27_READER_PADDING (BTC27_UNPACK64B_BUFSIZE + 8)
+
+// With PADDED 0 bits past inBufLen read as 0 and the buffer is never read
+// past inBufLen. With PADDED 1 the loads are not checked against inBufLen,
+// BTC27_READER_PADDING bytes past it must be readable and the bits read past
+// it are those of the padding, see overrun.
+template <int PADDED>
+class BitReaderT
+{
+public:
+
+    BitReaderT(const unsigned char* inBuf, unsigned int inBufLen) :
+        mInBuf(inBuf), mInBufLen(inBufLen), mInBufPos(0), mAccum(0), mAvail(0)
+    {
+    }
+
+    // Empty stream, see reset.
+    BitReaderT() : BitReaderT(nullptr, 0)
+    {
+    }
+
+    // Restart on another buffer.
+    inline void reset(const unsigned char* inBuf, unsigned int inBufLen)
+    {
+        mInBuf    = inBuf;
+        mInBufLen = inBufLen;
+        seekByte(0);
+    }
+
+    BitReaderT(const BitReaderT &) = delete;
+    BitReaderT& operator= (const BitReaderT &) = delete;
+
+    // Extract the next numBits (0..56) bits.
+    inline uint64_t get(unsigned int numBits)
+    {
+        if (mAvail < numBits) {
+            refill();
+        }
+        uint64_t field = mAccum & ((1ULL << numBits) - 1);
+        mAccum >>= numBits;
+        mAvail  -= numBits;
+        return field;
+    }
+
+    // Extract count bytes.
+    inline void getBytes(unsigned char* bytes, int count)
+    {
+        if (((position() & 7) == 0) && (PADDED || (byteIndex() + count <= mInBufLen))) {
+            // Byte aligned, copy straight from the stream.
+            memcpy(bytes, mInBuf + byteIndex(), count);
+            seekByte(byteIndex() + count);
+            return;
+        }
+        for(; count >= 4; count -= 4, bytes += 4) {
+            uint32_t word = (uint32_t)get(32);
+            memcpy(bytes, &word, sizeof(word));
+        }
+        for(int i = 0; i < count; i++) {
+            bytes[i] = (unsigned char)get(8);
+        }
+    }
+
+    // Extract count fixed-width fields of bitln (0..8) bits each, one per byte.
+    inline void getRun(unsigned char* syms, int count, unsigned int bitln)
+    {
+        if (bitln == 0) {
+            memset(syms, 0, count);
+            return;
+        } else if (bitln == 8) {
+            getBytes(syms, count);
+            return;
+        }
+        // Whole 64 symbol blocks occupy exactly bitln words.
+        unsigned char packed[BTC27_UNPACK64B_BUFSIZE] = {0};
+        for(; count >= 64; count -= 64, syms += 64) {
+            btcmpctr_unpack64B(getBlock64B(bitln, packed), bitln, syms);
+        }
+        for(int i = 0; i < count; i++) {
+            syms[i] = (unsigned char)get(bitln);
+        }
+    }
+
+    // getRun followed by btcmpctr_xfrmSym on every symbol, in the same pass.
+    inline void getRunXfrm(unsigned char* syms, int count, unsigned int bitln, int xfrm, const unsigned char* xfrmArg)
+    {
+        if (xfrm == BTC27_XFRM_NONE) {
+            getRun(syms, count, bitln);
+            return;
+        }
+        if ((bitln == 0) || ((xfrm == BTC27_XFRM_LOOKUP) && (bitln > BTC27_LOOKUP_MAXBITLN))) {
+            // Not produced by the encoder, indices are wrapped to the table.
+            getRun(syms, count, bitln);
+            for(int i = 0; i < count; i++) {
+                unsigned int sym = (xfrm == BTC27_XFRM_LOOKUP) ? (syms[i] & (BTC27_LOOKUP_SIZE - 1)) : syms[i];
+                syms[i] = btcmpctr_xfrmSym(sym, xfrm, xfrmArg);
+            }
+            return;
+        }
+        unsigned char packed[BTC27_UNPACK64B_BUFSIZE] = {0};
+        for(; count >= 64; count -= 64, syms += 64) {
+            btcmpctr_unpackXfrm64B(getBlock64B(bitln, packed), bitln, xfrm, xfrmArg, syms);
+        }
+        for(int i = 0; i < count; i++) {
+            syms[i] = btcmpctr_xfrmSym((unsigned int)get(bitln), xfrm, xfrmArg);
+        }
+    }
+
+    // Extract count single bits into a byte-per-bit map.
+    inline void getBitmap(unsigned char* bitmap, int count)
+    {
+        for(; count >= 64; count -= 64, bitmap += 64) {
+            uint64_t word = get(32);
+            word |= get(32) << 32;
+            btcmpctr_unpackBitmap64B(word, bitmap);
+        }
+        for(int i = 0; i < count; i++) {
+            bitmap[i] = (unsigned char)get(1);
+        }
+    }
+
+    // Move past numBits bits.
+    inline void skip(unsigned long long numBits)
+    {
+        if (numBits <= mAvail) {
+            mAccum >>= numBits;
+            mAvail  -= (unsigned int)numBits;
+            return;
+        }
+        unsigned long long pos = position() + numBits;
+        seekByte((unsigned int)(pos >> 3));
+        get((unsigned int)(pos & 7));
+    }
+
+    // Number of bits extracted so far.
+    inline unsigned long long position() const { return 8ULL*mInBufPos - mAvail; }
+
+    // Index of the byte holding the next bit and the bit index within it.
+    inline unsigned int byteIndex() const { return (unsigned int)(position() >> 3); }
+    inline unsigned int state() const { return (unsigned int)(position() & 7); }
+
+    // True once bits past inBufLen have been extracted.
+    inline bool overrun() const { return position() > 8ULL*mInBufLen; }
+
+private:
+
+    // Return the next 64 symbols of bitln bits and move past them. Byte
+    // aligned blocks are returned in place when BTC27_UNPACK64B_BUFSIZE bytes
+    // are readable, others are realigned 32 bits at a time into packed.
+    inline const unsigned char* getBlock64B(unsigned int bitln, unsigned char* packed)
+    {
+        if (((position() & 7) == 0) && (PADDED || (byteIndex() + BTC27_UNPACK64B_BUFSIZE <= mInBufLen))) {
+            const unsigned char* block = mInBuf + byteIndex();
+            seekByte(byteIndex() + 8*bitln);
+            return block;
+        }
+        for(unsigned int w = 0; w < 2*bitln; w++) {
+            uint32_t word = (uint32_t)get(32);
+            memcpy(packed + 4*w, &word, sizeof(word));
+        }
+        return packed;
+    }
+
+    // Continue from the start of byte pos, dropping the accumulator.
+    inline void seekByte(unsigned int pos)
+    {
+        mInBufPos = pos;
+        mAccum    = 0;
+        mAvail    = 0;
+    }
+
+    // Top the accumulator up to at least 56 bits.
+    inline void refill()
+    {
+        if (PADDED || (mInBufPos + 8 <= mInBufLen)) {
+            // Whole 64 bit load, the bytes which do not fit are loaded again
+            // by the next refill, at the same bit positions.
+            uint64_t word;
+            memcpy(&word, mInBuf + mInBufPos, sizeof(word));
+            mAccum |= word << mAvail;
+            mInBufPos += (63 - mAvail) >> 3;
+            mAvail    |= 56;
+        } else {
+            for(; mAvail <= 56; mAvail += 8, mInBufPos++) {
+                uint64_t byte = (mInBufPos < mInBufLen) ? mInBuf[mInBufPos] : 0;
+                mAccum |= byte << mAvail;
+            }
+        }
+    }
+
+    const unsigned char* mInBuf;
+    unsigned int         mInBufLen;
+    unsigned int         mInBufPos;  // Next byte to load into the accumulator
+    uint64_t             mAccum;
+    unsigned int         mAvail;     // Bits available in the accumulator
+};
+
+typedef BitReaderT<0> BitReader;
+
+} // namespace btc27
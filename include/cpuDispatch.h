@@ -0,0 +1,54 @@
+//
+// Copyright (C) 2023 Intel Corporation
+// SPDX-License-Identifier: Apache 2.0
+//
+
+//
+
+// Runtime selection of the SIMD kernels.
+// Every kernel has a scalar reference and SSE4.2, AVX2 and AVX-512 variants
+// producing bit-identical results, a few also have an AVX-512 VBMI variant.
+// The variants are compiled with function level target attributes, the tier
+// is chosen once from cpuid and can be lowered with the BTC27_CPU_TIER
+// environment variable (scalar, sse42, avx2, avx512 or avx512vbmi).
+//
+
+#pragma once
+
+namespace btc27
+{
+
+// Kernel tiers, in increasing order.
+#define BTC27_CPU_SCALAR  0
+#define BTC27_CPU_SSE42   1
+#define BTC27_CPU_AVX2    2
+#define BTC27_CPU_AVX512  3
+#define BTC27_CPU_AVX512_VBMI 4 // AVX-512 with VBMI and VBMI2 byte permutes and expands
+
+#define BTC27_CPU_TIER_ENV "BTC27_CPU_TIER"
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define BTC27_SIMD_X86
+#define BTC27_TARGET_SSE42  __attribute__((target("sse4.2,popcnt")))
+#define BTC27_TARGET_AVX2   __attribute__((target("avx2,popcnt")))
+#define BTC27_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+#define BTC27_TARGET_AVX512_VBMI __attribute__((target("avx512f,avx512bw,avx512vbmi,avx512vbmi2,avx2,popcnt")))
+#elif defined(_M_X64)
+#define BTC27_SIMD_X86
+#define BTC27_TARGET_SSE42
+#define BTC27_TARGET_AVX2
+#define BTC27_TARGET_AVX512
+#define BTC27_TARGET_AVX512_VBMI
+#endif
+
+// Highest tier supported by the CPU and the OS.
+int btcmpctr_cpuTierDetected();
+
+// Tier used by the kernels: the detected tier, lowered by BTC27_CPU_TIER_ENV.
+// Evaluated once, at load time.
+int btcmpctr_cpuTier();
+
+// Name of a tier, as accepted in BTC27_CPU_TIER_ENV.
+const char* btcmpctr_cpuTierName(int tier);
+
+} // namespace btc27
@@ -9,6 +9,11 @@
 //
 
 #include "bitCompactor.h"
+#include "cpuDispatch.h"
+
+#if defined(BTC27_SIMD_X86)
+#include <immintrin.h>
+#endif
 
 namespace btc27
 {
@@ -41,7 +46,6 @@ namespace btc27
 #define BITLN 5
 #define ALGO 2
 
-#define INCR_STATE_UC(state,len)  (*state)++; if(*state == 8) { *state = 0; (*len)++; }
 #define ELEM_SWAP(a,b) { register elem_type t=(a);(a)=(b);(b)=t; }
 
 //-----------------------------------------------------
@@ -59,6 +63,18 @@ namespace btc27
 
 #define MAXSYMS 16
 #define NUMSYMSBL 4
+
+// Predictors evaluated by btcmpctr_ChooseAlgo64B, Algo index 0..NUMPRDCT-1
+#define NUMPRDCT 6
+#define PRDCT_MASK_ALL ((1 << NUMPRDCT) - 1)
+// Adaptive pruning: predictors evaluated between full evaluations,
+// blocks between full evaluations, blocks between decays of the statistics,
+// full evaluations per ADAPT_DECAY blocks above which pruning is disabled
+// until the next decay.
+#define ADAPT_NUMLIKELY 2
+#define ADAPT_PERIOD 32
+#define ADAPT_DECAY 256
+#define ADAPT_MAXFULL (ADAPT_DECAY/2)
 //-----------------------------------------------------
 // 4K Block Size related constants
 //-----------------------------------------------------
@@ -67,7 +83,22 @@ namespace btc27
 #define BTMAP4K_IDX 1
 
 #define MAXSYMS4K 64
+// Unused entry of the symbol to bin lookup, > MAXSYMS4K
+#define BIN_EMPTY 0xFF
 #define NUMSYMSBL4K 6
+// Bound on the size of a block in the stream, in bytes: header, BINEXPPROC
+// symbols, BTEXPPROC and dual bitmaps and BIGBLKSIZE 8 bit symbols.
+#define MAXBLKBYTES (8 + MAXSYMS4K + 2*(BIGBLKSIZE/8) + BIGBLKSIZE)
+
+// Output types of btcmpctr_DecompressDequantEngine
+#define DEQUANT_F32 0
+#define DEQUANT_F16 1
+// Channel runs of DEQUANT_MINRUN elements or more are dequantized with a
+// common scale, shorter ones with per element scales. These are
+// precomputed once when the channel period (numChannels * channelStride)
+// is at most DEQUANT_MAXPERIOD elements, expanded per block otherwise.
+#define DEQUANT_MINRUN    64
+#define DEQUANT_MAXPERIOD (4*BIGBLKSIZE)
 
 //-----------------------------------------------------
 
@@ -77,127 +108,787 @@ namespace btc27
 // 2 --> 64B Alignment
 // 0 --> No  Alignment
 
-// Function Declarations
+//-----------------------------------------------------
+// SIMD kernels, the variant is selected at runtime (see cpuDispatch.h).
+// The kernels only process whole vectors and return the number of bytes
+// done, the callers finish the block with the scalar reference code.
+//-----------------------------------------------------
+// Extremes and sum of a block, see btcmpctr_calc_blk_stats.
+typedef struct btcmpctr_blk_ext_s
+{
+    unsigned int umin, umax;
+    unsigned int bmin, bmax; // Signed extremes, biased by 0x80
+    unsigned int bsum;       // Sum of biased bytes
+} btcmpctr_blk_ext_t;
 
-BitCompactor::BitCompactor() :
-        mVerbosityLevel(0)
+// Dequantized value of a decompressed byte, see DecompressDequantWrap.
+static inline float btcmpctr_dequantSym(unsigned char sym, int isSigned, float scale, float zeroPoint)
 {
-    std::fill_n(AlgoAry, BTC27_NUMALGO, &BitCompactor::btcmpctr_dummyprdct);
-    std::fill_n(AlgoAry4K, BTC27_NUM4KALGO, &BitCompactor::btcmpctr_dummyprdct);
+    float q = isSigned ? (float)(signed char)sym : (float)sym;
+    return (q - zeroPoint) * scale;
 }
 
-unsigned char BitCompactor::btcmpctr_insrt_byte( unsigned char  byte,
-                                   unsigned char  bitln,
-                                   unsigned int*  outBufLen,
-                                   unsigned char* outBuf,
-                                   unsigned char  state,
-                                   unsigned int*  accum,
-                                            int   flush
-                                 )
+// IEEE half precision bits of f, rounded to nearest even. A NaN gives the
+// quiet NaN 0x7E00 with the sign of f.
+static inline uint16_t btcmpctr_f32tof16(float f)
 {
-    unsigned char mask, thisBit, rem;
-    // Use 32bit operations to insert a byte into the accumulator
-    // Once 32bits are accumulated, push 4bytes to the outBuf
-    // and increment the outBufLen.
-    #ifdef __BTCMPCTR__EN_DBG__
-    mDebugStr.str(""); mDebugStr << "State = "<< std::to_string((int)state) << ", BitLen = "<< std::to_string(bitln) <<", Byte = "<< std::to_string(byte) <<", outByfLen = " << std::to_string(*outBufLen);
-    BTC_REPORT_INFO(mVerbosityLevel,11,mDebugStr.str().c_str());
-    #endif
-    if (flush) {
-        // Depending on state write the correct number of bytes to
-        // outBuf and increment outBufLen
-        if (state != 0) {
-            double numbytesf = state/8.0;
-            int numBytes = ceil(numbytesf);
-            #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Flushing numBytes = " << std::to_string(numBytes);
-            BTC_REPORT_INFO(mVerbosityLevel,11,mDebugStr.str().c_str());
-            #endif
-            #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Accum = " << std::to_string(*accum);
-            BTC_REPORT_INFO(mVerbosityLevel,11,mDebugStr.str().c_str());
-            #endif
-            for(int i = 0; i < numBytes; i++) {
-                #ifdef __BTCMPCTR__EN_DBG__
-                mDebugStr.str(""); mDebugStr << "Flushing Byte = " << std::to_string((unsigned char)(*accum));
-                BTC_REPORT_INFO(mVerbosityLevel,11,mDebugStr.str().c_str());
-                #endif
-                *(outBuf + *outBufLen + i) = (unsigned char)(*accum);
-                (*accum) >>= 8;
-            }
-                (*outBufLen) += numBytes;
-            state = 0;
+    const uint32_t magic = 126u << 23; // 0.5f, places the half subnormal mantissa in the float LSBs
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+    uint32_t h;
+    if (x >= (143u << 23)) {
+        // 65536 and above, infinity and NaN
+        h = (x > (255u << 23)) ? 0x7E00 : 0x7C00;
+    } else if (x < (113u << 23)) {
+        // Half subnormal or zero, the float addition rounds the mantissa.
+        float m, r;
+        memcpy(&m, &magic, sizeof(m));
+        memcpy(&r, &x, sizeof(r));
+        r += m;
+        memcpy(&h, &r, sizeof(h));
+        h -= magic;
+    } else {
+        // Rebias the exponent and round the 13 dropped bits to nearest even,
+        // a carry out of the mantissa gives the next exponent or infinity.
+        h = (x + (0xFFFu - (112u << 23)) + ((x >> 13) & 1)) >> 13;
+    }
+    return (uint16_t)(h | (sign >> 16));
+}
+
+typedef struct btcmpctr_kernels_s
+{
+    // Clears *isConst if a byte differs from inAry[0].
+    int (*constBlk)(const unsigned char* inAry, int blkSize, int* isConst);
+    // Folds the bytes into ext.
+    int (*blkExtremes)(const unsigned char* inAry, int blkSize, btcmpctr_blk_ext_t* ext);
+    // Adds the number of residuals fitting k bits to cumSyms[k], k = [1..7].
+    int (*dualCumSyms)(const unsigned char* residual, int blkSize, int* cumSyms);
+    // bitmap[i] = 1 if residual[i] does not fit bitln bits.
+    int (*dualBitmap)(const unsigned char* residual, int blkSize, unsigned char bitln, unsigned char* bitmap);
+    // BTEXPPROC reconstruction: outBuf[i] = bitmap[i] ? bytes[(*numBytes)++] : fill.
+    // bytes holds bytesLen readable bytes.
+    int (*btExpand)(const unsigned char* bitmap, const unsigned char* bytes, int bytesLen, unsigned char fill,
+                    int blkSize, unsigned char* outBuf, int* numBytes);
+    // outBuf[i] = btcmpctr_dequantSym(syms[i], ...)
+    int (*dequantF32)(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, float* outBuf);
+    // outBuf[i] = btcmpctr_f32tof16(btcmpctr_dequantSym(syms[i], ...))
+    int (*dequantF16)(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, uint16_t* outBuf);
+    // outBuf[i] = btcmpctr_dequantSym(syms[i], isSigned, scale[i], zeroPoint[i])
+    int (*dequantF32Ary)(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, float* outBuf);
+    // outBuf[i] = btcmpctr_f32tof16(btcmpctr_dequantSym(syms[i], isSigned, scale[i], zeroPoint[i]))
+    int (*dequantF16Ary)(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, uint16_t* outBuf);
+} btcmpctr_kernels_t;
+
+static int btcmpctr_constBlk_scalar(const unsigned char*, int, int*) { return 0; }
+static int btcmpctr_blkExtremes_scalar(const unsigned char*, int, btcmpctr_blk_ext_t*) { return 0; }
+static int btcmpctr_dualCumSyms_scalar(const unsigned char*, int, int*) { return 0; }
+static int btcmpctr_dualBitmap_scalar(const unsigned char*, int, unsigned char, unsigned char*) { return 0; }
+static int btcmpctr_btExpand_scalar(const unsigned char*, const unsigned char*, int, unsigned char, int, unsigned char*, int*) { return 0; }
+static int btcmpctr_dequantF32_scalar(const unsigned char*, int, int, float, float, float*) { return 0; }
+static int btcmpctr_dequantF16_scalar(const unsigned char*, int, int, float, float, uint16_t*) { return 0; }
+static int btcmpctr_dequantF32Ary_scalar(const unsigned char*, int, int, const float*, const float*, float*) { return 0; }
+static int btcmpctr_dequantF16Ary_scalar(const unsigned char*, int, int, const float*, const float*, uint16_t*) { return 0; }
+
+#if defined(BTC27_SIMD_X86)
+// Horizontal unsigned byte minimum/maximum of a vector
+BTC27_TARGET_SSE42 static inline unsigned int btcmpctr_hmin_epu8(__m128i x)
+{
+    x = _mm_min_epu8(x, _mm_srli_si128(x, 8));
+    x = _mm_min_epu8(x, _mm_srli_si128(x, 4));
+    x = _mm_min_epu8(x, _mm_srli_si128(x, 2));
+    x = _mm_min_epu8(x, _mm_srli_si128(x, 1));
+    return _mm_cvtsi128_si32(x) & 0xFF;
+}
+BTC27_TARGET_SSE42 static inline unsigned int btcmpctr_hmax_epu8(__m128i x)
+{
+    x = _mm_max_epu8(x, _mm_srli_si128(x, 8));
+    x = _mm_max_epu8(x, _mm_srli_si128(x, 4));
+    x = _mm_max_epu8(x, _mm_srli_si128(x, 2));
+    x = _mm_max_epu8(x, _mm_srli_si128(x, 1));
+    return _mm_cvtsi128_si32(x) & 0xFF;
+}
+
+//-----------------------------------------------------
+// SSE4.2
+//-----------------------------------------------------
+BTC27_TARGET_SSE42 static int btcmpctr_constBlk_sse42(const unsigned char* inAry, int blkSize, int* isConst)
+{
+    const __m128i first = _mm_set1_epi8((char)inAry[0]);
+    __m128i diff = _mm_setzero_si128();
+    int i = 0;
+    for(; (i + 16) <= blkSize; i += 16) {
+        diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(inAry + i)), first));
+    }
+    *isConst &= _mm_testz_si128(diff, diff);
+    return i;
+}
+
+BTC27_TARGET_SSE42 static int btcmpctr_blkExtremes_sse42(const unsigned char* inAry, int blkSize, btcmpctr_blk_ext_t* ext)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    __m128i vumin = _mm_set1_epi8((char)ext->umin), vumax = _mm_set1_epi8((char)ext->umax);
+    __m128i vbmin = _mm_set1_epi8((char)ext->bmin), vbmax = _mm_set1_epi8((char)ext->bmax);
+    __m128i vbsum = _mm_setzero_si128();
+    int i = 0;
+    for(; (i + 16) <= blkSize; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(inAry + i));
+        __m128i b = _mm_xor_si128(x, bias);
+        vumin = _mm_min_epu8(vumin, x);
+        vumax = _mm_max_epu8(vumax, x);
+        vbmin = _mm_min_epu8(vbmin, b);
+        vbmax = _mm_max_epu8(vbmax, b);
+        vbsum = _mm_add_epi64(vbsum, _mm_sad_epu8(b, _mm_setzero_si128()));
+    }
+    ext->umin  = btcmpctr_hmin_epu8(vumin);
+    ext->umax  = btcmpctr_hmax_epu8(vumax);
+    ext->bmin  = btcmpctr_hmin_epu8(vbmin);
+    ext->bmax  = btcmpctr_hmax_epu8(vbmax);
+    ext->bsum += _mm_cvtsi128_si32(vbsum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(vbsum, vbsum));
+    return i;
+}
+
+BTC27_TARGET_SSE42 static int btcmpctr_dualCumSyms_sse42(const unsigned char* residual, int blkSize, int* cumSyms)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi8(1);
+    __m128i vcum[8];
+    for(int k = 1; k < 8; k++) {
+        vcum[k] = zero;
+    }
+    int i = 0;
+    for(; (i + 16) <= blkSize; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(residual + i));
+        for(int k = 1; k < 8; k++) {
+            // 1 in every byte with no bit set above the k LSBs
+            __m128i hi    = _mm_and_si128(x, _mm_set1_epi8((char)(0xFF << k)));
+            __m128i fitsK = _mm_and_si128(_mm_cmpeq_epi8(hi, zero), one);
+            vcum[k] = _mm_add_epi64(vcum[k], _mm_sad_epu8(fitsK, zero));
         }
+    }
+    for(int k = 1; k < 8; k++) {
+        cumSyms[k] += _mm_cvtsi128_si32(vcum[k]) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(vcum[k], vcum[k]));
+    }
+    return i;
+}
 
-    } else {
-        // State indicates the number of bits valid in accum.
-        // First see if based on state and bitln we will cross
-        // over 32bits.
-        if( (state + bitln) > 32) {
-            // Need to first insert 32-state bits first from byte and
-            // then insert the rest.
-            rem = 32 - state;
-            mask = ~(0xFF << rem);
-            thisBit = byte & mask;
-            *accum  |= (thisBit << state);
-            *((unsigned int *)(outBuf+ *outBufLen)) = *accum;
-            (*outBufLen) += 4;
-            state = 0;
-            *accum = 0;
-            // Remaining bits
-            byte = byte >> rem;
-            rem = bitln - rem;
-            mask = ~(0xFF << rem);
-            thisBit = byte & mask;
-            *accum  |= (thisBit << state);
-            state += rem;
-        } else {
-            // Can insert bitln number of bits into accum
-            mask    = ~(0xFF << bitln); // This should give us correct bit values from byte.
-            thisBit = byte & mask;
-            // Leftshift this by state
-            *accum  |= (thisBit << state);
-            state += bitln;
-            if(state == 32) {
-                *((unsigned int*)(outBuf + *outBufLen)) = *accum;
-                (*outBufLen) += 4;
-                state = 0;
-                *accum = 0;
-            }
+BTC27_TARGET_SSE42 static int btcmpctr_dualBitmap_sse42(const unsigned char* residual, int blkSize, unsigned char bitln, unsigned char* bitmap)
+{
+    const __m128i zero   = _mm_setzero_si128();
+    const __m128i one    = _mm_set1_epi8(1);
+    const __m128i hiMask = _mm_set1_epi8((char)(0xFF << bitln));
+    int i = 0;
+    for(; (i + 16) <= blkSize; i += 16) {
+        __m128i x     = _mm_loadu_si128((const __m128i*)(residual + i));
+        __m128i fits  = _mm_cmpeq_epi8(_mm_and_si128(x, hiMask), zero);
+        _mm_storeu_si128((__m128i*)(bitmap + i), _mm_andnot_si128(fits, one));
+    }
+    return i;
+}
+
+// Shuffles gathering the bytes selected by an 8 bit map, indexed by the map.
+// Entry k of shuf[m] is the number of bits set in m below bit k.
+typedef struct btcmpctr_expand_lut_s
+{
+    uint64_t shuf[256];
+} btcmpctr_expand_lut_t;
+
+static btcmpctr_expand_lut_t btcmpctr_makeExpandLut()
+{
+    btcmpctr_expand_lut_t lut;
+    for(int m = 0; m < 256; m++) {
+        uint64_t shuf = 0;
+        int cnt = 0;
+        for(int k = 0; k < 8; k++) {
+            shuf |= (uint64_t)cnt << (8*k);
+            cnt  += (m >> k) & 1;
+        }
+        lut.shuf[m] = shuf;
+    }
+    return lut;
+}
+
+static const btcmpctr_expand_lut_t& btcmpctr_expandLut()
+{
+    static const btcmpctr_expand_lut_t lut = btcmpctr_makeExpandLut();
+    return lut;
+}
+
+// 16 bytes per step: one table shuffle per 8 bitmap entries, the second
+// offset by the bytes taken by the first. Also used by the AVX2 and AVX-512
+// tiers, the in-lane byte shuffle does not widen usefully.
+BTC27_TARGET_SSE42 static int btcmpctr_btExpand_sse42(const unsigned char* bitmap, const unsigned char* bytes, int bytesLen, unsigned char fill,
+                                                     int blkSize, unsigned char* outBuf, int* numBytes)
+{
+    const btcmpctr_expand_lut_t& lut = btcmpctr_expandLut();
+    const __m128i vfill = _mm_set1_epi8((char)fill);
+    const __m128i zero  = _mm_setzero_si128();
+    int cnt = *numBytes;
+    int i = 0;
+    for(; ((i + 16) <= blkSize) && ((cnt + 16) <= bytesLen); i += 16) {
+        __m128i b  = _mm_loadu_si128((const __m128i*)(bitmap + i));
+        unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_slli_epi64(b, 7));
+        int cnt0 = _mm_popcnt_u32(m & 0xFF);
+        __m128i shuf = _mm_set_epi64x((long long)lut.shuf[m >> 8], (long long)lut.shuf[m & 0xFF]);
+        shuf = _mm_add_epi8(shuf, _mm_slli_si128(_mm_set1_epi8((char)cnt0), 8));
+        __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(bytes + cnt)), shuf);
+        _mm_storeu_si128((__m128i*)(outBuf + i), _mm_blendv_epi8(x, vfill, _mm_cmpeq_epi8(b, zero)));
+        cnt += _mm_popcnt_u32(m);
+    }
+    *numBytes = cnt;
+    return i;
+}
+
+// btcmpctr_dequantSym of 4 bytes.
+template <int SIGNED>
+BTC27_TARGET_SSE42 static inline __m128 btcmpctr_dequant4_sse42(const unsigned char* syms, __m128 scale, __m128 zeroPoint)
+{
+    int word;
+    memcpy(&word, syms, sizeof(word));
+    __m128i x = _mm_cvtsi32_si128(word);
+    __m128i q = SIGNED ? _mm_cvtepi8_epi32(x) : _mm_cvtepu8_epi32(x);
+    return _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(q), zeroPoint), scale);
+}
+
+// btcmpctr_f32tof16 of 4 floats, in the low half of each 32 bit lane.
+BTC27_TARGET_SSE42 static inline __m128i btcmpctr_f32tof16_sse42(__m128 f)
+{
+    const __m128i magic = _mm_set1_epi32(126 << 23);
+    __m128i x    = _mm_castps_si128(f);
+    __m128i sign = _mm_and_si128(x, _mm_set1_epi32((int)0x80000000u));
+    x = _mm_xor_si128(x, sign);
+    __m128i isNan     = _mm_castps_si128(_mm_cmpunord_ps(_mm_castsi128_ps(x), _mm_castsi128_ps(x)));
+    __m128i isRegular = _mm_cmpgt_epi32(_mm_set1_epi32(143 << 23), x);
+    __m128i isSub     = _mm_cmpgt_epi32(_mm_set1_epi32(113 << 23), x);
+    __m128i special   = _mm_or_si128(_mm_set1_epi32(0x7C00), _mm_and_si128(isNan, _mm_set1_epi32(0x0200)));
+    __m128i sub  = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(x), _mm_castsi128_ps(magic))), magic);
+    __m128i odd  = _mm_and_si128(_mm_srli_epi32(x, 13), _mm_set1_epi32(1));
+    __m128i norm = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(x, _mm_set1_epi32((int)(0xFFFu - (112u << 23)))), odd), 13);
+    __m128i h = _mm_blendv_epi8(special, _mm_blendv_epi8(norm, sub, isSub), isRegular);
+    return _mm_or_si128(h, _mm_srli_epi32(sign, 16));
+}
+
+template <int SIGNED>
+BTC27_TARGET_SSE42 static int btcmpctr_dequantF32_sse42(const unsigned char* syms, int count, float scale, float zeroPoint, float* outBuf)
+{
+    const __m128 vscale = _mm_set1_ps(scale), vzp = _mm_set1_ps(zeroPoint);
+    int i = 0;
+    for(; (i + 8) <= count; i += 8) {
+        _mm_storeu_ps(outBuf + i,     btcmpctr_dequant4_sse42<SIGNED>(syms + i,     vscale, vzp));
+        _mm_storeu_ps(outBuf + i + 4, btcmpctr_dequant4_sse42<SIGNED>(syms + i + 4, vscale, vzp));
+    }
+    return i;
+}
+
+BTC27_TARGET_SSE42 static int btcmpctr_dequantF32_sse42(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, float* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF32_sse42<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF32_sse42<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+template <int SIGNED>
+BTC27_TARGET_SSE42 static int btcmpctr_dequantF16_sse42(const unsigned char* syms, int count, float scale, float zeroPoint, uint16_t* outBuf)
+{
+    const __m128 vscale = _mm_set1_ps(scale), vzp = _mm_set1_ps(zeroPoint);
+    int i = 0;
+    for(; (i + 8) <= count; i += 8) {
+        __m128i lo = btcmpctr_f32tof16_sse42(btcmpctr_dequant4_sse42<SIGNED>(syms + i,     vscale, vzp));
+        __m128i hi = btcmpctr_f32tof16_sse42(btcmpctr_dequant4_sse42<SIGNED>(syms + i + 4, vscale, vzp));
+        _mm_storeu_si128((__m128i*)(outBuf + i), _mm_packus_epi32(lo, hi));
+    }
+    return i;
+}
+
+BTC27_TARGET_SSE42 static int btcmpctr_dequantF16_sse42(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, uint16_t* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF16_sse42<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF16_sse42<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+template <int SIGNED>
+BTC27_TARGET_SSE42 static int btcmpctr_dequantF32Ary_sse42(const unsigned char* syms, int count, const float* scale, const float* zeroPoint, float* outBuf)
+{
+    int i = 0;
+    for(; (i + 8) <= count; i += 8) {
+        _mm_storeu_ps(outBuf + i,     btcmpctr_dequant4_sse42<SIGNED>(syms + i,     _mm_loadu_ps(scale + i),     _mm_loadu_ps(zeroPoint + i)));
+        _mm_storeu_ps(outBuf + i + 4, btcmpctr_dequant4_sse42<SIGNED>(syms + i + 4, _mm_loadu_ps(scale + i + 4), _mm_loadu_ps(zeroPoint + i + 4)));
+    }
+    return i;
+}
+
+BTC27_TARGET_SSE42 static int btcmpctr_dequantF32Ary_sse42(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, float* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF32Ary_sse42<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF32Ary_sse42<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+template <int SIGNED>
+BTC27_TARGET_SSE42 static int btcmpctr_dequantF16Ary_sse42(const unsigned char* syms, int count, const float* scale, const float* zeroPoint, uint16_t* outBuf)
+{
+    int i = 0;
+    for(; (i + 8) <= count; i += 8) {
+        __m128i lo = btcmpctr_f32tof16_sse42(btcmpctr_dequant4_sse42<SIGNED>(syms + i,     _mm_loadu_ps(scale + i),     _mm_loadu_ps(zeroPoint + i)));
+        __m128i hi = btcmpctr_f32tof16_sse42(btcmpctr_dequant4_sse42<SIGNED>(syms + i + 4, _mm_loadu_ps(scale + i + 4), _mm_loadu_ps(zeroPoint + i + 4)));
+        _mm_storeu_si128((__m128i*)(outBuf + i), _mm_packus_epi32(lo, hi));
+    }
+    return i;
+}
+
+BTC27_TARGET_SSE42 static int btcmpctr_dequantF16Ary_sse42(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, uint16_t* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF16Ary_sse42<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF16Ary_sse42<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+//-----------------------------------------------------
+// AVX2
+//-----------------------------------------------------
+BTC27_TARGET_AVX2 static int btcmpctr_constBlk_avx2(const unsigned char* inAry, int blkSize, int* isConst)
+{
+    const __m256i first = _mm256_set1_epi8((char)inAry[0]);
+    __m256i diff = _mm256_setzero_si256();
+    int i = 0;
+    for(; (i + 32) <= blkSize; i += 32) {
+        diff = _mm256_or_si256(diff, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(inAry + i)), first));
+    }
+    *isConst &= _mm256_testz_si256(diff, diff);
+    return i;
+}
+
+BTC27_TARGET_AVX2 static int btcmpctr_blkExtremes_avx2(const unsigned char* inAry, int blkSize, btcmpctr_blk_ext_t* ext)
+{
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    __m256i vumin = _mm256_set1_epi8((char)ext->umin), vumax = _mm256_set1_epi8((char)ext->umax);
+    __m256i vbmin = _mm256_set1_epi8((char)ext->bmin), vbmax = _mm256_set1_epi8((char)ext->bmax);
+    __m256i vbsum = _mm256_setzero_si256();
+    int i = 0;
+    for(; (i + 32) <= blkSize; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(inAry + i));
+        __m256i b = _mm256_xor_si256(x, bias);
+        vumin = _mm256_min_epu8(vumin, x);
+        vumax = _mm256_max_epu8(vumax, x);
+        vbmin = _mm256_min_epu8(vbmin, b);
+        vbmax = _mm256_max_epu8(vbmax, b);
+        vbsum = _mm256_add_epi64(vbsum, _mm256_sad_epu8(b, _mm256_setzero_si256()));
+    }
+    ext->umin = btcmpctr_hmin_epu8(_mm_min_epu8(_mm256_castsi256_si128(vumin), _mm256_extracti128_si256(vumin, 1)));
+    ext->umax = btcmpctr_hmax_epu8(_mm_max_epu8(_mm256_castsi256_si128(vumax), _mm256_extracti128_si256(vumax, 1)));
+    ext->bmin = btcmpctr_hmin_epu8(_mm_min_epu8(_mm256_castsi256_si128(vbmin), _mm256_extracti128_si256(vbmin, 1)));
+    ext->bmax = btcmpctr_hmax_epu8(_mm_max_epu8(_mm256_castsi256_si128(vbmax), _mm256_extracti128_si256(vbmax, 1)));
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(vbsum), _mm256_extracti128_si256(vbsum, 1));
+    ext->bsum += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+    return i;
+}
+
+BTC27_TARGET_AVX2 static int btcmpctr_dualCumSyms_avx2(const unsigned char* residual, int blkSize, int* cumSyms)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for(; (i + 32) <= blkSize; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(residual + i));
+        for(int k = 1; k < 8; k++) {
+            __m256i fitsK = _mm256_cmpeq_epi8(_mm256_and_si256(x, _mm256_set1_epi8((char)(0xFF << k))), zero);
+            cumSyms[k] += _mm_popcnt_u32((unsigned int)_mm256_movemask_epi8(fitsK));
+        }
+    }
+    return i;
+}
+
+BTC27_TARGET_AVX2 static int btcmpctr_dualBitmap_avx2(const unsigned char* residual, int blkSize, unsigned char bitln, unsigned char* bitmap)
+{
+    const __m256i zero   = _mm256_setzero_si256();
+    const __m256i one    = _mm256_set1_epi8(1);
+    const __m256i hiMask = _mm256_set1_epi8((char)(0xFF << bitln));
+    int i = 0;
+    for(; (i + 32) <= blkSize; i += 32) {
+        __m256i x    = _mm256_loadu_si256((const __m256i*)(residual + i));
+        __m256i fits = _mm256_cmpeq_epi8(_mm256_and_si256(x, hiMask), zero);
+        _mm256_storeu_si256((__m256i*)(bitmap + i), _mm256_andnot_si256(fits, one));
+    }
+    return i;
+}
+
+// btcmpctr_dequantSym of 8 bytes.
+template <int SIGNED>
+BTC27_TARGET_AVX2 static inline __m256 btcmpctr_dequant8_avx2(const unsigned char* syms, __m256 scale, __m256 zeroPoint)
+{
+    __m128i x = _mm_loadl_epi64((const __m128i*)syms);
+    __m256i q = SIGNED ? _mm256_cvtepi8_epi32(x) : _mm256_cvtepu8_epi32(x);
+    return _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(q), zeroPoint), scale);
+}
+
+// btcmpctr_f32tof16 of 8 floats, in the low half of each 32 bit lane.
+BTC27_TARGET_AVX2 static inline __m256i btcmpctr_f32tof16_avx2(__m256 f)
+{
+    const __m256i magic = _mm256_set1_epi32(126 << 23);
+    __m256i x    = _mm256_castps_si256(f);
+    __m256i sign = _mm256_and_si256(x, _mm256_set1_epi32((int)0x80000000u));
+    x = _mm256_xor_si256(x, sign);
+    __m256i isNan     = _mm256_castps_si256(_mm256_cmp_ps(_mm256_castsi256_ps(x), _mm256_castsi256_ps(x), _CMP_UNORD_Q));
+    __m256i isRegular = _mm256_cmpgt_epi32(_mm256_set1_epi32(143 << 23), x);
+    __m256i isSub     = _mm256_cmpgt_epi32(_mm256_set1_epi32(113 << 23), x);
+    __m256i special   = _mm256_or_si256(_mm256_set1_epi32(0x7C00), _mm256_and_si256(isNan, _mm256_set1_epi32(0x0200)));
+    __m256i sub  = _mm256_sub_epi32(_mm256_castps_si256(_mm256_add_ps(_mm256_castsi256_ps(x), _mm256_castsi256_ps(magic))), magic);
+    __m256i odd  = _mm256_and_si256(_mm256_srli_epi32(x, 13), _mm256_set1_epi32(1));
+    __m256i norm = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(x, _mm256_set1_epi32((int)(0xFFFu - (112u << 23)))), odd), 13);
+    __m256i h = _mm256_blendv_epi8(special, _mm256_blendv_epi8(norm, sub, isSub), isRegular);
+    return _mm256_or_si256(h, _mm256_srli_epi32(sign, 16));
+}
+
+// Also used by the AVX-512 tiers, bound by the stores.
+template <int SIGNED>
+BTC27_TARGET_AVX2 static int btcmpctr_dequantF32_avx2(const unsigned char* syms, int count, float scale, float zeroPoint, float* outBuf)
+{
+    const __m256 vscale = _mm256_set1_ps(scale), vzp = _mm256_set1_ps(zeroPoint);
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        _mm256_storeu_ps(outBuf + i,     btcmpctr_dequant8_avx2<SIGNED>(syms + i,     vscale, vzp));
+        _mm256_storeu_ps(outBuf + i + 8, btcmpctr_dequant8_avx2<SIGNED>(syms + i + 8, vscale, vzp));
+    }
+    return i;
+}
+
+BTC27_TARGET_AVX2 static int btcmpctr_dequantF32_avx2(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, float* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF32_avx2<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF32_avx2<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+template <int SIGNED>
+BTC27_TARGET_AVX2 static int btcmpctr_dequantF16_avx2(const unsigned char* syms, int count, float scale, float zeroPoint, uint16_t* outBuf)
+{
+    const __m256 vscale = _mm256_set1_ps(scale), vzp = _mm256_set1_ps(zeroPoint);
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        __m256i lo = btcmpctr_f32tof16_avx2(btcmpctr_dequant8_avx2<SIGNED>(syms + i,     vscale, vzp));
+        __m256i hi = btcmpctr_f32tof16_avx2(btcmpctr_dequant8_avx2<SIGNED>(syms + i + 8, vscale, vzp));
+        // The pack interleaves the 128 bit lanes of lo and hi.
+        __m256i h  = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)(outBuf + i), h);
+    }
+    return i;
+}
+
+BTC27_TARGET_AVX2 static int btcmpctr_dequantF16_avx2(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, uint16_t* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF16_avx2<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF16_avx2<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+// Also used by the AVX-512 tiers, bound by the stores.
+template <int SIGNED>
+BTC27_TARGET_AVX2 static int btcmpctr_dequantF32Ary_avx2(const unsigned char* syms, int count, const float* scale, const float* zeroPoint, float* outBuf)
+{
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        _mm256_storeu_ps(outBuf + i,     btcmpctr_dequant8_avx2<SIGNED>(syms + i,     _mm256_loadu_ps(scale + i),     _mm256_loadu_ps(zeroPoint + i)));
+        _mm256_storeu_ps(outBuf + i + 8, btcmpctr_dequant8_avx2<SIGNED>(syms + i + 8, _mm256_loadu_ps(scale + i + 8), _mm256_loadu_ps(zeroPoint + i + 8)));
+    }
+    return i;
+}
+
+BTC27_TARGET_AVX2 static int btcmpctr_dequantF32Ary_avx2(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, float* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF32Ary_avx2<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF32Ary_avx2<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+template <int SIGNED>
+BTC27_TARGET_AVX2 static int btcmpctr_dequantF16Ary_avx2(const unsigned char* syms, int count, const float* scale, const float* zeroPoint, uint16_t* outBuf)
+{
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        __m256i lo = btcmpctr_f32tof16_avx2(btcmpctr_dequant8_avx2<SIGNED>(syms + i,     _mm256_loadu_ps(scale + i),     _mm256_loadu_ps(zeroPoint + i)));
+        __m256i hi = btcmpctr_f32tof16_avx2(btcmpctr_dequant8_avx2<SIGNED>(syms + i + 8, _mm256_loadu_ps(scale + i + 8), _mm256_loadu_ps(zeroPoint + i + 8)));
+        // The pack interleaves the 128 bit lanes of lo and hi.
+        __m256i h  = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)(outBuf + i), h);
+    }
+    return i;
+}
+
+BTC27_TARGET_AVX2 static int btcmpctr_dequantF16Ary_avx2(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, uint16_t* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF16Ary_avx2<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF16Ary_avx2<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+// GCC 12 warns about the undefined pass-through operand inside the AVX-512 intrinsics.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+//-----------------------------------------------------
+// AVX-512 (F + BW)
+//-----------------------------------------------------
+BTC27_TARGET_AVX512 static int btcmpctr_constBlk_avx512(const unsigned char* inAry, int blkSize, int* isConst)
+{
+    const __m512i first = _mm512_set1_epi8((char)inAry[0]);
+    __m512i diff = _mm512_setzero_si512();
+    int i = 0;
+    for(; (i + 64) <= blkSize; i += 64) {
+        diff = _mm512_or_si512(diff, _mm512_xor_si512(_mm512_loadu_si512(inAry + i), first));
+    }
+    *isConst &= (_mm512_test_epi8_mask(diff, diff) == 0);
+    return i;
+}
+
+BTC27_TARGET_AVX512 static int btcmpctr_blkExtremes_avx512(const unsigned char* inAry, int blkSize, btcmpctr_blk_ext_t* ext)
+{
+    const __m512i bias = _mm512_set1_epi8((char)0x80);
+    __m512i vumin = _mm512_set1_epi8((char)ext->umin), vumax = _mm512_set1_epi8((char)ext->umax);
+    __m512i vbmin = _mm512_set1_epi8((char)ext->bmin), vbmax = _mm512_set1_epi8((char)ext->bmax);
+    __m512i vbsum = _mm512_setzero_si512();
+    int i = 0;
+    for(; (i + 64) <= blkSize; i += 64) {
+        __m512i x = _mm512_loadu_si512(inAry + i);
+        __m512i b = _mm512_xor_si512(x, bias);
+        vumin = _mm512_min_epu8(vumin, x);
+        vumax = _mm512_max_epu8(vumax, x);
+        vbmin = _mm512_min_epu8(vbmin, b);
+        vbmax = _mm512_max_epu8(vbmax, b);
+        vbsum = _mm512_add_epi64(vbsum, _mm512_sad_epu8(b, _mm512_setzero_si512()));
+    }
+    __m256i umin256 = _mm256_min_epu8(_mm512_castsi512_si256(vumin), _mm512_extracti64x4_epi64(vumin, 1));
+    __m256i umax256 = _mm256_max_epu8(_mm512_castsi512_si256(vumax), _mm512_extracti64x4_epi64(vumax, 1));
+    __m256i bmin256 = _mm256_min_epu8(_mm512_castsi512_si256(vbmin), _mm512_extracti64x4_epi64(vbmin, 1));
+    __m256i bmax256 = _mm256_max_epu8(_mm512_castsi512_si256(vbmax), _mm512_extracti64x4_epi64(vbmax, 1));
+    ext->umin = btcmpctr_hmin_epu8(_mm_min_epu8(_mm256_castsi256_si128(umin256), _mm256_extracti128_si256(umin256, 1)));
+    ext->umax = btcmpctr_hmax_epu8(_mm_max_epu8(_mm256_castsi256_si128(umax256), _mm256_extracti128_si256(umax256, 1)));
+    ext->bmin = btcmpctr_hmin_epu8(_mm_min_epu8(_mm256_castsi256_si128(bmin256), _mm256_extracti128_si256(bmin256, 1)));
+    ext->bmax = btcmpctr_hmax_epu8(_mm_max_epu8(_mm256_castsi256_si128(bmax256), _mm256_extracti128_si256(bmax256, 1)));
+    ext->bsum += (unsigned int)_mm512_reduce_add_epi64(vbsum);
+    return i;
+}
+
+BTC27_TARGET_AVX512 static int btcmpctr_dualCumSyms_avx512(const unsigned char* residual, int blkSize, int* cumSyms)
+{
+    int i = 0;
+    for(; (i + 64) <= blkSize; i += 64) {
+        __m512i x = _mm512_loadu_si512(residual + i);
+        for(int k = 1; k < 8; k++) {
+            __mmask64 fitsK = _mm512_testn_epi8_mask(x, _mm512_set1_epi8((char)(0xFF << k)));
+            cumSyms[k] += (int)_mm_popcnt_u64(fitsK);
         }
     }
+    return i;
+}
+
+BTC27_TARGET_AVX512 static int btcmpctr_dualBitmap_avx512(const unsigned char* residual, int blkSize, unsigned char bitln, unsigned char* bitmap)
+{
+    const __m512i one    = _mm512_set1_epi8(1);
+    const __m512i hiMask = _mm512_set1_epi8((char)(0xFF << bitln));
+    int i = 0;
+    for(; (i + 64) <= blkSize; i += 64) {
+        __mmask64 isLong = _mm512_test_epi8_mask(_mm512_loadu_si512(residual + i), hiMask);
+        _mm512_storeu_si512(bitmap + i, _mm512_maskz_mov_epi8(isLong, one));
+    }
+    return i;
+}
+
+// btcmpctr_f32tof16(btcmpctr_dequantSym()) of 16 bytes. The conversion
+// instruction rounds like btcmpctr_f32tof16, NaNs are first replaced by the
+// quiet NaN it converts to 0x7E00.
+template <int SIGNED>
+BTC27_TARGET_AVX512 static inline __m256i btcmpctr_dequantF16x16_avx512(const unsigned char* syms, __m512 scale, __m512 zeroPoint)
+{
+    const __m512i signMask = _mm512_set1_epi32((int)0x80000000u);
+    const __m512i quietNan = _mm512_set1_epi32(0x7FC00000);
+    __m128i x = _mm_loadu_si128((const __m128i*)syms);
+    __m512i q = SIGNED ? _mm512_cvtepi8_epi32(x) : _mm512_cvtepu8_epi32(x);
+    __m512  f = _mm512_mul_ps(_mm512_sub_ps(_mm512_cvtepi32_ps(q), zeroPoint), scale);
+    __mmask16 isNan = _mm512_cmp_ps_mask(f, f, _CMP_UNORD_Q);
+    __m512i fi = _mm512_castps_si512(f);
+    fi = _mm512_mask_or_epi32(fi, isNan, _mm512_and_si512(fi, signMask), quietNan);
+    return _mm512_cvtps_ph(_mm512_castsi512_ps(fi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+
+template <int SIGNED>
+BTC27_TARGET_AVX512 static int btcmpctr_dequantF16_avx512(const unsigned char* syms, int count, float scale, float zeroPoint, uint16_t* outBuf)
+{
+    const __m512 vscale = _mm512_set1_ps(scale), vzp = _mm512_set1_ps(zeroPoint);
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        _mm256_storeu_si256((__m256i*)(outBuf + i), btcmpctr_dequantF16x16_avx512<SIGNED>(syms + i, vscale, vzp));
+    }
+    return i;
+}
+
+BTC27_TARGET_AVX512 static int btcmpctr_dequantF16_avx512(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, uint16_t* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF16_avx512<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF16_avx512<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+template <int SIGNED>
+BTC27_TARGET_AVX512 static int btcmpctr_dequantF16Ary_avx512(const unsigned char* syms, int count, const float* scale, const float* zeroPoint, uint16_t* outBuf)
+{
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        __m256i h = btcmpctr_dequantF16x16_avx512<SIGNED>(syms + i, _mm512_loadu_ps(scale + i), _mm512_loadu_ps(zeroPoint + i));
+        _mm256_storeu_si256((__m256i*)(outBuf + i), h);
+    }
+    return i;
+}
+
+BTC27_TARGET_AVX512 static int btcmpctr_dequantF16Ary_avx512(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, uint16_t* outBuf)
+{
+    return isSigned ? btcmpctr_dequantF16Ary_avx512<1>(syms, count, scale, zeroPoint, outBuf)
+                    : btcmpctr_dequantF16Ary_avx512<0>(syms, count, scale, zeroPoint, outBuf);
+}
+
+//-----------------------------------------------------
+// AVX-512 VBMI (+ VBMI2)
+//-----------------------------------------------------
+BTC27_TARGET_AVX512_VBMI static int btcmpctr_btExpand_avx512vbmi(const unsigned char* bitmap, const unsigned char* bytes, int, unsigned char fill,
+                                                                int blkSize, unsigned char* outBuf, int* numBytes)
+{
+    // The expanding load only reads the selected bytes, no bound on bytes is needed.
+    const __m512i vfill = _mm512_set1_epi8((char)fill);
+    int cnt = *numBytes;
+    int i = 0;
+    for(; (i + 64) <= blkSize; i += 64) {
+        __m512i   b = _mm512_loadu_si512(bitmap + i);
+        __mmask64 m = _mm512_test_epi8_mask(b, b);
+        _mm512_storeu_si512(outBuf + i, _mm512_mask_expandloadu_epi8(vfill, m, bytes + cnt));
+        cnt += (int)_mm_popcnt_u64(m);
+    }
+    *numBytes = cnt;
+    return i;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+static btcmpctr_kernels_t btcmpctr_selectKernels()
+{
+    switch(btcmpctr_cpuTier()) {
+#if defined(BTC27_SIMD_X86)
+        case BTC27_CPU_AVX512_VBMI:
+            return {btcmpctr_constBlk_avx512, btcmpctr_blkExtremes_avx512, btcmpctr_dualCumSyms_avx512, btcmpctr_dualBitmap_avx512,
+                    btcmpctr_btExpand_avx512vbmi, btcmpctr_dequantF32_avx2, btcmpctr_dequantF16_avx512,
+                    btcmpctr_dequantF32Ary_avx2, btcmpctr_dequantF16Ary_avx512};
+        case BTC27_CPU_AVX512:
+            return {btcmpctr_constBlk_avx512, btcmpctr_blkExtremes_avx512, btcmpctr_dualCumSyms_avx512, btcmpctr_dualBitmap_avx512,
+                    btcmpctr_btExpand_sse42, btcmpctr_dequantF32_avx2, btcmpctr_dequantF16_avx512,
+                    btcmpctr_dequantF32Ary_avx2, btcmpctr_dequantF16Ary_avx512};
+        case BTC27_CPU_AVX2:
+            return {btcmpctr_constBlk_avx2, btcmpctr_blkExtremes_avx2, btcmpctr_dualCumSyms_avx2, btcmpctr_dualBitmap_avx2,
+                    btcmpctr_btExpand_sse42, btcmpctr_dequantF32_avx2, btcmpctr_dequantF16_avx2,
+                    btcmpctr_dequantF32Ary_avx2, btcmpctr_dequantF16Ary_avx2};
+        case BTC27_CPU_SSE42:
+            return {btcmpctr_constBlk_sse42, btcmpctr_blkExtremes_sse42, btcmpctr_dualCumSyms_sse42, btcmpctr_dualBitmap_sse42,
+                    btcmpctr_btExpand_sse42, btcmpctr_dequantF32_sse42, btcmpctr_dequantF16_sse42,
+                    btcmpctr_dequantF32Ary_sse42, btcmpctr_dequantF16Ary_sse42};
+#endif
+        default:
+            return {btcmpctr_constBlk_scalar, btcmpctr_blkExtremes_scalar, btcmpctr_dualCumSyms_scalar, btcmpctr_dualBitmap_scalar,
+                    btcmpctr_btExpand_scalar, btcmpctr_dequantF32_scalar, btcmpctr_dequantF16_scalar,
+                    btcmpctr_dequantF32Ary_scalar, btcmpctr_dequantF16Ary_scalar};
+    }
+}
+
+static const btcmpctr_kernels_t& btcmpctr_kernels()
+{
+    static const btcmpctr_kernels_t kernels = btcmpctr_selectKernels();
+    return kernels;
+}
+
+// Dequantize count bytes sharing scale and zeroPoint.
+static void btcmpctr_dequant(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, float* outBuf)
+{
+    int i = btcmpctr_kernels().dequantF32(syms, count, isSigned, scale, zeroPoint, outBuf);
+    for(; i < count; i++) {
+        outBuf[i] = btcmpctr_dequantSym(syms[i], isSigned, scale, zeroPoint);
+    }
+}
+
+static void btcmpctr_dequant(const unsigned char* syms, int count, int isSigned, float scale, float zeroPoint, uint16_t* outBuf)
+{
+    int i = btcmpctr_kernels().dequantF16(syms, count, isSigned, scale, zeroPoint, outBuf);
+    for(; i < count; i++) {
+        outBuf[i] = btcmpctr_f32tof16(btcmpctr_dequantSym(syms[i], isSigned, scale, zeroPoint));
+    }
+}
+
+// Dequantize count bytes with per byte scale and zeroPoint.
+static void btcmpctr_dequant(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, float* outBuf)
+{
+    int i = btcmpctr_kernels().dequantF32Ary(syms, count, isSigned, scale, zeroPoint, outBuf);
+    for(; i < count; i++) {
+        outBuf[i] = btcmpctr_dequantSym(syms[i], isSigned, scale[i], zeroPoint[i]);
+    }
+}
+
+static void btcmpctr_dequant(const unsigned char* syms, int count, int isSigned, const float* scale, const float* zeroPoint, uint16_t* outBuf)
+{
+    int i = btcmpctr_kernels().dequantF16Ary(syms, count, isSigned, scale, zeroPoint, outBuf);
+    for(; i < count; i++) {
+        outBuf[i] = btcmpctr_f32tof16(btcmpctr_dequantSym(syms[i], isSigned, scale[i], zeroPoint[i]));
+    }
+}
 
-    //for(int j = 0; j < 8; j++) {
-    //    if(j < bitln) {
-    //        mask    = 1 << j;
-    //        thisBit = byte & mask;
-    //        thisBit = thisBit >> j;
-    //        mask    = thisBit << state;
-    //        outBuf[*outBufLen] |= mask;
-    //        INCR_STATE(state,outBufLen,outBuf)
-    //        mDebugStr.str(""); mDebugStr << "State = " << std::to_string((int)state) << ", Len = " << std::to_string(*outBufLen) << ", Bit = " << std::to_string(thisBit);
-    //        BTC_REPORT_INFO(mVerbosityLevel,6,mDebugStr.str().c_str())
-    //    }
-    //}
-    return state;
+// Per element scale and zeroPoint of count elements, from the channel of the
+// first one and its index in the channel run, which are advanced past them.
+static void btcmpctr_dequantExpand(const BitCompactor::btcmpctr_dequant_args_t& dequant,
+                                   unsigned int&                               channel,
+                                   unsigned int&                               chanPos,
+                                   unsigned int                                count,
+                                   float*                                      scale,
+                                   float*                                      zeroPoint)
+{
+    if (dequant.channelStride == 1) {
+        // Channel last layout, consecutive elements have consecutive channels.
+        for(unsigned int i = 0; i < count; ) {
+            unsigned int run = std::min(count - i, dequant.numChannels - channel);
+            std::copy(dequant.scale + channel, dequant.scale + channel + run, scale + i);
+            if (dequant.zeroPoint) {
+                std::copy(dequant.zeroPoint + channel, dequant.zeroPoint + channel + run, zeroPoint + i);
+            } else {
+                std::fill(zeroPoint + i, zeroPoint + i + run, 0.0f);
+            }
+            i       += run;
+            channel = (channel + run == dequant.numChannels) ? 0 : (channel + run);
+        }
+        return;
+    }
+    for(unsigned int i = 0; i < count; ) {
+        unsigned int run = std::min(count - i, dequant.channelStride - chanPos);
+        std::fill(scale + i, scale + i + run, dequant.scale[channel]);
+        std::fill(zeroPoint + i, zeroPoint + i + run, dequant.zeroPoint ? dequant.zeroPoint[channel] : 0.0f);
+        i       += run;
+        chanPos += run;
+        if (chanPos == dequant.channelStride) {
+            chanPos = 0;
+            channel = (channel + 1 == dequant.numChannels) ? 0 : (channel + 1);
+        }
+    }
 }
 
+// Function Declarations
+
+BitCompactor::BitCompactor() :
+        mAlgoAryCfg(-1),
+        mStreamVersion(BTC27_STREAM_V0),
+        mVerbosityLevel(0)
+{
+}
 
 // Insert header into the output Buffer.
-unsigned char BitCompactor::btcmpctr_insrt_hdr(int chosenAlgo,
-                                 unsigned char  bitln,
-                                 unsigned int*  outBufLen,
-                                 unsigned char* outBuf,
-                                 unsigned char  state,
-                                 unsigned int*  accum,
-                                 unsigned char  eofr,
-                                 int            workingBlkSize,
-                                 int            mixedBlkSize,
-                                 int            align
-                                )
+void BitCompactor::btcmpctr_insrt_hdr(BitWriter&     writer,
+                                      int            chosenAlgo,
+                                      unsigned char  bitln,
+                                      unsigned char  eofr,
+                                      int            workingBlkSize,
+                                      int            mixedBlkSize,
+                                      int            align
+                                     )
 {
     #ifdef __BTCMPCTR__EN_DBG__
-    mDebugStr.str(""); mDebugStr << "Inserting Header, outBuf Length = " << std::to_string(*outBufLen);
+    mDebugStr.str(""); mDebugStr << "Inserting Header, outBuf Length = " << std::to_string(writer.length());
     BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
     #endif
     #ifdef __BTCMPCTR__EN_DBG__
@@ -214,72 +905,61 @@ unsigned char BitCompactor::btcmpctr_insrt_hdr(int chosenAlgo,
 
     if (eofr) {
         //just insert the no compression bit '0' and return.
-        state = btcmpctr_insrt_byte(EOFR,2,outBufLen,outBuf,state,accum,0);
+        writer.insert(EOFR,2);
         // Once the SKIP header is inserted, check the alignment requirement.
         if ( (align == 1) || (align == 2) ) {
             // 32B alignment
-            // OutBufLen and State combined together will tell the current alignment.
+            // Bytes in the buffer and the writer state combined together will tell the current alignment.
             #ifdef __BTCMPCTR__EN_DBG__
             mDebugStr.str(""); mDebugStr << "Aligning to = " << std::to_string(align);
             BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
             #endif
-            double numbytesf = state/8.0;
-            unsigned int bytesinBuf = (*outBufLen + (unsigned int)ceil(numbytesf));
+            unsigned int bytesinBuf = writer.bytesInBuf();
             unsigned int alignB = ((align == 1) ? 32 : 64);
             unsigned int numBytesToInsert = ((bytesinBuf % alignB) == 0) ? 0 : alignB - (bytesinBuf % alignB);
-            unsigned int numBitsToInsert = ((state % 8) == 0) ? 0 : 8-(state %8);
             #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "numBits = " << std::to_string(numBitsToInsert) << ", numBytes = " << std::to_string(numBytesToInsert) << ", outBufLen = " << std::to_string(*outBufLen) << ", state = " << std::to_string(state);
+            mDebugStr.str(""); mDebugStr << "numBytes = " << std::to_string(numBytesToInsert) << ", outBufLen = " << std::to_string(writer.length()) << ", state = " << std::to_string(writer.state());
             BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
             #endif
-            state = btcmpctr_insrt_byte(0,numBitsToInsert,outBufLen,outBuf,state,accum,0);
+            writer.alignToByte();
             for(unsigned int i = 0; i < numBytesToInsert; i++) {
-                state = btcmpctr_insrt_byte(0,8,outBufLen,outBuf,state,accum,0);
+                writer.insert(0,8);
             }
         }
         // Below will ensure byte alignment.
-        state = btcmpctr_insrt_byte(EOFR,2,outBufLen,outBuf,state,accum,1); // Flush
-        return state;
+        writer.flush();
+        return;
     } else  if (chosenAlgo == BITC_ALG_NONE) {
         if (isLastBlk) {
-            state = btcmpctr_insrt_byte(LASTBLK,2,outBufLen,outBuf,state,accum,0);
+            writer.insert(LASTBLK,2);
             // Insert 6 bits of block Size in bytes.
-            state = btcmpctr_insrt_byte(workingBlkSize,6,outBufLen,outBuf,state,accum,0);
+            writer.insert(workingBlkSize,6);
         } else {
-            state = btcmpctr_insrt_byte(UNCMPRSD,2,outBufLen,outBuf,state,accum,0);
+            writer.insert(UNCMPRSD,2);
             if(mixedBlkSize) {
-                if (is4K) {
-                    state = btcmpctr_insrt_byte(1,2,outBufLen,outBuf,state,accum,0);
-                } else {
-                    state = btcmpctr_insrt_byte(0,2,outBufLen,outBuf,state,accum,0);
-                }
+                writer.insert(is4K ? 1 : 0,2);
             }
         }
-        return state;
+        return;
     } else {
         // We are guarantteed to come in here when workingBlkSize != 64
-        // First form the header byte and then use a loop to insert it into
-        // the output buffer.
+        // First form the header byte and then insert it into the output buffer.
         //Algo is 3 bits, hence mask off the rest of the bits from chosen Algo.
-        state = btcmpctr_insrt_byte(CMPRSD,2,outBufLen,outBuf,state,accum,0);
+        writer.insert(CMPRSD,2);
         if(mixedBlkSize) {
-            if (is4K) {
-                state = btcmpctr_insrt_byte(1,2,outBufLen,outBuf,state,accum,0);
-            } else {
-                state = btcmpctr_insrt_byte(0,2,outBufLen,outBuf,state,accum,0);
-            }
+            writer.insert(is4K ? 1 : 0,2);
         }
-        state = btcmpctr_insrt_byte(chosenAlgo,3,outBufLen,outBuf,state,accum,0);
+        writer.insert(chosenAlgo,3);
         //Bit Lenght is in the range of 1 - 8. it will get encoded to 0 - 7, with 0 indicating 8 bits.
         if ((bitln == 8) && !is16bitmode) { bitln = 0; } // Only if in 8 bit mode, in 16 bit mode this chack should change to == 16. TODO
         if ((bitln == 16) && is16bitmode) { bitln = 0; } // Only if in 8 bit mode, in 16 bit mode this chack should change to == 16. TODO
-        state = btcmpctr_insrt_byte(bitln,3,outBufLen,outBuf,state,accum,0);
+        writer.insert(bitln,3);
 
         #ifdef __BTCMPCTR__EN_DBG__
-        mDebugStr.str(""); mDebugStr << "Inserting Header, outBuf Length = " << std::to_string(*outBufLen);
+        mDebugStr.str(""); mDebugStr << "Inserting Header, outBuf Length = " << std::to_string(writer.length());
         BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
         #endif
-        return state;
+        return;
     }
 }
 
@@ -319,6 +999,32 @@ void BitCompactor::btcmpctr_calc_bitln( const unsigned char* residual,
 // A function that takes a buffer (residue) and calculates the dual length encoding.
 // One of the lengths could be < 8 and is indicated in a 0 in the bitmap. A 1 in the
 // bitmap indicates 8bit symbols.
+// A symbol needs at most k bits when it is < 2^k, so the cumulative bit length
+// histogram is counted directly with one mask test per length, and the bitmap is
+// a single compare against the chosen length.
+void BitCompactor::btcmpctr_calc_dual_cumsyms(const unsigned char* residual,
+                                                       int   blkSize,
+                                                       int*  cumSyms
+                                              )
+{
+    int bin[9]; // need to store 1 - 8 bitln
+
+    for(int k = 0; k < 9; k++) {
+        cumSyms[k] = 0;
+        bin[k]     = 0;
+    }
+    int i = btcmpctr_kernels().dualCumSyms(residual, blkSize, cumSyms);
+    for(int j = i; j < blkSize; j++) {
+        // Calculate the number of bits needed to encode the symbol
+        bin[(residual[j] == 0) ? 1 : BitCompactor::mCeilLog2LUT[(residual[j]+1)]]++;
+    }
+    for(int k = 1; k < 9; k++) {
+        bin[k] += bin[k-1];
+        cumSyms[k] += bin[k];
+    }
+    cumSyms[8] = blkSize;
+}
+
 void BitCompactor::btcmpctr_calc_dual_bitln( const unsigned char*   residual,
                                              unsigned char*         bitln,
                                              int                    blkSize,
@@ -326,66 +1032,29 @@ void BitCompactor::btcmpctr_calc_dual_bitln( const unsigned char*   residual,
                                              int*                   compressedSize
                              )
 {
-    // First calculate/bin the bitlengths
-    unsigned char bin[9]; // need to store 1 - 8 bitln
-    unsigned char symbolBitln[BLKSIZE]; // Assume this is used only for 64B blocks.
-    unsigned char sBitln;
-    int cSize[9];
-    unsigned char cumSumL,cumSumH;
+    // cumSyms[k] is the number of symbols that can be encoded in k bits, k = [1..8]
+    int cumSyms[9];
+    int i = 0;
 
-    for(int i = 1; i < 9; i++) {
-        bin[i] = 0;
-    }
-    for(int i = 0; i < blkSize; i++) {
-        // Calculate the number of bits needed to encode the symbol
-        sBitln = (*(residual+i) == 0) ? 1 : BitCompactor::mCeilLog2LUT[(*(residual+i)+1)];
-        // Increment the bin for that bitlength.
-        bin[sBitln]++;
-        // Store the bitlenght for the i th symbol.
-        symbolBitln[i] = sBitln;
-    }
+    btcmpctr_calc_dual_cumsyms(residual, blkSize, cumSyms);
     #ifdef __BTCMPCTR__EN_DBG__
-    for(int i = 1; i < 9; i++) {
-        mDebugStr.str(""); mDebugStr << "Num symbols with length " << std::to_string(i)<< " is " << std::to_string(bin[i]);
+    for(int k = 1; k < 9; k++) {
+        mDebugStr.str(""); mDebugStr << "Num symbols with length " << std::to_string(k)<< " is " << std::to_string(cumSyms[k] - cumSyms[k-1]);
         BTC_REPORT_INFO(mVerbosityLevel,8,mDebugStr.str().c_str());
     }
     #endif
-    // For each of the bins, calculate the compressed Size.
-    // And find the bitln that results in the minimum compressed Size.
-    for (int i = 1; i < 9; i++) {
-        cumSumL = 0;
-        for(int j = 1; j <= i; j++) {
-            cumSumL += bin[j];
-        }
-        cumSumH = 0;
-        for(int j = i+1; j < 9; j++) {
-            cumSumH += bin[j];
-        }
-        cSize[i] = cumSumL*i + cumSumH*8;
-        // Find the minimum compressed Size.
-        if (i == 1) {
-            *compressedSize = cSize[i];
-            *bitln          = i;
-        } else {
-            if (cSize[i] < *compressedSize) {
-                *compressedSize = cSize[i];
-                *bitln          = i;
-            }
-        }
-    }
+    // Find the bitln that results in the minimum compressed Size.
+    // Accounts for the forced long symbol below.
+    *compressedSize = btcmpctr_calc_dual_cost(cumSyms,blkSize,bitln);
+
     // *bitln contains the chosen bitln < 8.
     // Calculate the bitmap
-    uint32_t shortSymbolCount = 0;
-    uint32_t longSymbolCount = 0;
-    for(int i = 0; i < blkSize; i++) {
-       if (symbolBitln[i] <= *bitln) {
-           bitmap[i] = 0;
-           shortSymbolCount++;
-       } else {
-           bitmap[i] = 1;
-           longSymbolCount++;
-       }
+    i = btcmpctr_kernels().dualBitmap(residual, blkSize, *bitln, bitmap);
+    for(; i < blkSize; i++) {
+        bitmap[i] = (residual[i] >> *bitln) ? 1 : 0;
     }
+    int shortSymbolCount = cumSyms[*bitln];
+    int longSymbolCount  = blkSize - shortSymbolCount;
 
     // Dual-length encoding only makes sense if both symbol lengths are actually needed
     // In the case where we find we can use the short length for all symbols, we could
@@ -395,14 +1064,12 @@ void BitCompactor::btcmpctr_calc_dual_bitln( const unsigned char*   residual,
     {
         // Remedy situation with compressed blocks made up entirely of 'short' symbols
         // by forcing at least one long (8-bit) symbol at start of bitmap.
-        // Make adjustment to compressedSize and to bitmap[0].
+        // The adjustment to compressedSize is made by btcmpctr_calc_dual_cost.
         #ifdef __BTCMPCTR__EN_DBG__
         mDebugStr.str(""); mDebugStr << "calc_dual_bitln: 8-bit Symbols: 1 (forced); " << std::to_string(*bitln) << "-bit Symbols: " << shortSymbolCount-1;
         BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
         #endif
 
-        // account for the fact that using the 8-bit length for the first symbol will require more bits
-        *compressedSize = *compressedSize + (8-(*bitln));
         // set element zero in bitmap to 1 (i.e. force long/8-bit symbol length)
         bitmap[0] = 1;
     }
@@ -434,13 +1101,14 @@ void BitCompactor::btcmpctr_tounsigned(const signed char* inAry,
     }
 }
 // Do Min Predict algo on a buffer, return minimum number and the bitln. These are pointers given to the function.
+template <int BLK>
 void BitCompactor::btcmpctr_minprdct(
                         btcmpctr_algo_args_t* algoArg
                       )
 {
     *(algoArg->minimum) = 255;
 
-    for(int i = 0; i < algoArg->blkSize; i++) {// TODO : inAry size
+    for(int i = 0; i < BLK; i++) {// TODO : inAry size
         #ifdef __BTCMPCTR__EN_DBG__
         mDebugStr.str(""); mDebugStr << "In minprdct, inAry["<< std::to_string(i) << "] is "<< std::to_string(algoArg->inAry[i]);
         BTC_REPORT_INFO(mVerbosityLevel,12,mDebugStr.str().c_str());
@@ -454,28 +1122,29 @@ void BitCompactor::btcmpctr_minprdct(
     BTC_REPORT_INFO(mVerbosityLevel,7,mDebugStr.str().c_str());
     #endif
     // Subtract the minimum from the array and make a copy of the array.
-    for(int i = 0; i < algoArg->blkSize; i++) {
+    for(int i = 0; i < BLK; i++) {
         algoArg->residual[i] = algoArg->inAry[i] - *algoArg->minimum;
     }
     // Find Bit Length
-    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,algoArg->blkSize,algoArg->minFixedBitLn);
+    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,BLK,algoArg->minFixedBitLn);
 }
 
 // Do Min Signed Predict algo on a buffer, return minimum number and the bitln. These are pointers given to the function.
+template <int BLK>
 void BitCompactor::btcmpctr_minSprdct(
                          btcmpctr_algo_args_t* algoArg
                        )
 {
-    signed char  residualS[BLKSIZE], inSAry[BLKSIZE];
+    signed char  residualS[BLK], inSAry[BLK];
     signed char minS;
-    for(int i = 0; i < algoArg->blkSize; i++) {// TODO : inAry size
+    for(int i = 0; i < BLK; i++) {// TODO : inAry size
         inSAry[i] = (signed char )algoArg->inAry[i];
     }
 
     *algoArg->minimum = 255;
     minS = 127;
 
-    for(int i = 0; i < algoArg->blkSize; i++) {// TODO : inAry size
+    for(int i = 0; i < BLK; i++) {// TODO : inAry size
         #ifdef __BTCMPCTR__EN_DBG__
         mDebugStr.str(""); mDebugStr << "In minprdct, inSAry[" << std::to_string(i) <<"] is "<< std::to_string(inSAry[i]);
         BTC_REPORT_INFO(mVerbosityLevel,12,mDebugStr.str().c_str());
@@ -495,7 +1164,7 @@ void BitCompactor::btcmpctr_minSprdct(
     #endif
 
     // Subtract the minimum from the array and make a copy of the array.
-    for(int i = 0; i < algoArg->blkSize; i++) {
+    for(int i = 0; i < BLK; i++) {
         residualS[i] = inSAry[i] - minS;
         #ifdef __BTCMPCTR__EN_DBG__
         mDebugStr.str(""); mDebugStr << "In minSprdct, residual[" << std::to_string(i) << "] = " << std::to_string(residualS[i]);
@@ -503,84 +1172,87 @@ void BitCompactor::btcmpctr_minSprdct(
         #endif
     }
     //Convert to Unsigned
-    btcmpctr_tounsigned(residualS, algoArg->residual,algoArg->blkSize);
+    btcmpctr_tounsigned(residualS, algoArg->residual,BLK);
     // Find Bit Length
-    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,algoArg->blkSize,algoArg->minFixedBitLn);
+    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,BLK,algoArg->minFixedBitLn);
 }
 // Do Mean Signed Predict algo on a buffer, return minimum number and the bitln. These are pointers given to the function.
+template <int BLK>
 void BitCompactor::btcmpctr_muprdct(
                         btcmpctr_algo_args_t* algoArg
                       )
 {
     signed char* inSAry = (signed char *)algoArg->inAry;
-    signed char  residualS[BLKSIZE];
+    signed char  residualS[BLK];
     signed char muS;
     double      sum,mud;
 
     *algoArg->minimum = 0;
     muS = 0;
     sum = 0;
-    for(int i = 0; i < algoArg->blkSize; i++) {
+    for(int i = 0; i < BLK; i++) {
             sum += inSAry[i];
     }
-    mud = sum/algoArg->blkSize;
+    mud = sum/BLK;
     muS = (signed char)(round(mud));
 
     // Subtract the minimum from the array and make a copy of the array.
-    for(int i = 0; i < algoArg->blkSize; i++) {
+    for(int i = 0; i < BLK; i++) {
         residualS[i] = inSAry[i] - muS;
     }
     *algoArg->minimum = (unsigned char)muS;
     //Convert to Unsigned
-    btcmpctr_tounsigned(residualS, algoArg->residual,algoArg->blkSize);
+    btcmpctr_tounsigned(residualS, algoArg->residual,BLK);
     // Find Bit Length
-    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,algoArg->blkSize,algoArg->minFixedBitLn);
+    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,BLK,algoArg->minFixedBitLn);
 }
 // Do Median Signed Predict algo on a buffer, return minimum number and the bitln. These are pointers given to the function.
 // http://ndevilla.free.fr/median/median/src/quickselect.c
 
+template <int BLK>
 void BitCompactor::btcmpctr_medprdct(
                         btcmpctr_algo_args_t* algoArg
                       )
 {
     signed char* inSAry = (signed char *)algoArg->inAry;
-    signed char  residualS[BLKSIZE];
+    signed char  residualS[BLK];
     signed char medianS;
-    for(int i = 0; i < algoArg->blkSize; i++) {
-        algoArg->residual[i] = algoArg->inAry[i];
-    }
-    // Sort the array, Even length => median = arr[blkSize/2 -1], Odd length => median = arr[blkSize/2]
-    medianS = (signed char) getMedianNaive((unsigned char *)algoArg->residual,algoArg->blkSize);
+    btcmpctr_blk_stats_t stats;
+    // Even length => median = arr[blkSize/2 -1], Odd length => median = arr[blkSize/2] of the sorted array
+    btcmpctr_calc_blk_stats(algoArg->inAry,BLK,&stats);
+    medianS = (signed char) getMedianHist(&stats);
 
     // Subtract the minimum from the array and make a copy of the array.
-    for(int i = 0; i < algoArg->blkSize; i++) {
+    for(int i = 0; i < BLK; i++) {
         residualS[i] = inSAry[i] - medianS;
     }
     *algoArg->minimum = (unsigned char)medianS;
     //Convert to Unsigned
-    btcmpctr_tounsigned(residualS, algoArg->residual,algoArg->blkSize);
+    btcmpctr_tounsigned(residualS, algoArg->residual,BLK);
     // Find Bit Length
-    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,algoArg->blkSize,algoArg->minFixedBitLn);
+    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,BLK,algoArg->minFixedBitLn);
 }
 // No Predict, just look at the maximum in the array
+template <int BLK>
 void BitCompactor::btcmpctr_noprdct(
                         btcmpctr_algo_args_t* algoArg
                      )
 {
     // Copy inAry to residual
-    for(int i = 0; i< algoArg->blkSize; i++) {
+    for(int i = 0; i< BLK; i++) {
         algoArg->residual[i] = algoArg->inAry[i];
     }
-    btcmpctr_calc_bitln(algoArg->inAry,algoArg->bitln,algoArg->blkSize,algoArg->minFixedBitLn);
+    btcmpctr_calc_bitln(algoArg->inAry,algoArg->bitln,BLK,algoArg->minFixedBitLn);
 }
 // No Sign Predict. Store
+template <int BLK>
 void BitCompactor::btcmpctr_noSprdct(
                         btcmpctr_algo_args_t* algoArg
                      )
 {
     // First convert to unsigned representation by storing MSB in LSB.
-    btcmpctr_tounsigned((signed char*) algoArg->inAry, algoArg->residual,algoArg->blkSize);
-    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,algoArg->blkSize,algoArg->minFixedBitLn);
+    btcmpctr_tounsigned((signed char*) algoArg->inAry, algoArg->residual,BLK);
+    btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,BLK,algoArg->minFixedBitLn);
     #ifdef __BTCMPCTR__EN_DBG__
     mDebugStr.str(""); mDebugStr << "In NoSPrdct, bitln is " << std::to_string(*algoArg->bitln);
     BTC_REPORT_INFO(mVerbosityLevel,7,mDebugStr.str().c_str());
@@ -593,6 +1265,7 @@ void BitCompactor::btcmpctr_noSprdct(
 // Also need to return the array of bytes to be inserted after the header. Can be stored in *minimum.
 // Need a way to return the number of symbols valid. So that the correct number of bytes can be
 // inserted.
+template <int BLK>
 void BitCompactor::btcmpctr_binCmpctprdct(
                             btcmpctr_algo_args_t* algoArg
                            )
@@ -601,33 +1274,35 @@ void BitCompactor::btcmpctr_binCmpctprdct(
     mDebugStr.str(""); mDebugStr << "In binCmpctprdct";
     BTC_REPORT_INFO(mVerbosityLevel,7,mDebugStr.str().c_str());
     #endif
-    int inBins   = 0;
     int allinBin = 1;
     int maxsyms;
-    maxsyms = (algoArg->blkSize > 64) ? MAXSYMS4K : MAXSYMS;
+    int numSyms;
+    maxsyms = (BLK > BLKSIZE) ? MAXSYMS4K : MAXSYMS;
 
-    *algoArg->numSyms     = 1;
+    // Symbol to bin lookup, bins are numbered in order of first occurrence.
+    unsigned char binOf[256];
+    memset(binOf, BIN_EMPTY, sizeof(binOf));
+
+    numSyms               = 1;
     algoArg->minimum[0]   = algoArg->inAry[0];
     algoArg->residual[0]  = 0;
-    for(int i = 1; i < algoArg->blkSize; i++) {
-        inBins = 0;
-        for(int k = 0; k < *algoArg->numSyms; k++) {
-            if(algoArg->inAry[i] == algoArg->minimum[k]) {
-                inBins = 1;
-                algoArg->residual[i] = k;
-                break;
-            }
-        }
-        if (inBins == 0) {
-            if(*algoArg->numSyms == maxsyms) {
+    binOf[algoArg->inAry[0]] = 0;
+    for(int i = 1; i < BLK; i++) {
+        unsigned char sym = algoArg->inAry[i];
+        unsigned char bin = binOf[sym];
+        if (bin == BIN_EMPTY) {
+            if(numSyms == maxsyms) {
+                // One symbol too many, stop binning.
                 allinBin = 0;
                 break;
             }
-            algoArg->minimum[*algoArg->numSyms] = algoArg->inAry[i];
-            algoArg->residual[i] = *algoArg->numSyms;
-           (*algoArg->numSyms)++;
+            bin = numSyms++;
+            binOf[sym] = bin;
+            algoArg->minimum[bin] = sym;
         }
+        algoArg->residual[i] = bin;
     }
+    *algoArg->numSyms = numSyms;
     // Check if all symbols are in < MAXSYMS bins
     if(allinBin == 0) {
         #ifdef __BTCMPCTR__EN_DBG__
@@ -635,18 +1310,17 @@ void BitCompactor::btcmpctr_binCmpctprdct(
         BTC_REPORT_INFO(mVerbosityLevel,7,mDebugStr.str().c_str());
         #endif
         *algoArg->bitln = 8;
-        for(int i = 0; i < algoArg->blkSize; i++) {
-            algoArg->residual[i] = algoArg->inAry[i];
-        }
+        memcpy(algoArg->residual, algoArg->inAry, BLK);
     } else {
         // Resudaul should already have the correct bin
         // index in them.
-        btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,algoArg->blkSize,algoArg->minFixedBitLn);
+        btcmpctr_calc_bitln(algoArg->residual,algoArg->bitln,BLK,algoArg->minFixedBitLn);
     }
 }
 // Bitmap Proc
 // Bit map preproccing, find the top bin symbol and removes that symbol
 // while preserving a bitmap showing the location of the removed symbol.
+template <int BLK>
 void BitCompactor::btcmpctr_btMapprdct(
                             btcmpctr_algo_args_t* algoArg
                         )
@@ -657,26 +1331,22 @@ void BitCompactor::btcmpctr_btMapprdct(
     #endif
     int maxIdx     = 0;
     int maxSymFreq = 0;
-    int symbFreq[256];
-    for(int i = 0; i < 256; i++) {
-        symbFreq[i] = 0;
-    }
+    btcmpctr_blk_stats_t stats;
 
     // Bin the Block and find the maximum frequency symbol.
-    for(int i = 0; i < algoArg->blkSize; i++) {
-        symbFreq[algoArg->inAry[i]]++;
-    }
+    btcmpctr_calc_blk_stats(algoArg->inAry,BLK,&stats);
     // Find Max Index.
-    for(int i = 0; i < 256; i++) {
-        if(symbFreq[i] > maxSymFreq) {
+    for(int i = stats.umin; i <= stats.umax; i++) {
+        int symbFreq = stats.cumHist[i+1] - stats.cumHist[i];
+        if(symbFreq > maxSymFreq) {
             maxIdx = i;
-            maxSymFreq = symbFreq[i];
+            maxSymFreq = symbFreq;
         }
     }
     // Max Frequency Symbol is maxIdx.
     // Find this maxIdx in the inAry and create a bitmap.
     int cnt = 0;
-    for(int i =0; i < algoArg->blkSize; i++) {
+    for(int i =0; i < BLK; i++) {
         if(algoArg->inAry[i] == maxIdx) {
             algoArg->bitmap[i] = 0;
         } else {
@@ -689,52 +1359,15 @@ void BitCompactor::btcmpctr_btMapprdct(
     BTC_REPORT_INFO(mVerbosityLevel,7,mDebugStr.str().c_str());
     #endif
     *algoArg->minimum  = maxIdx;
-    *algoArg->bitln    = 1;
+    // The remaining bytes are kept whole, the decoder extracts them in 8 bits.
+    *algoArg->bitln    = 8;
     *algoArg->numBytes = cnt;
 
 }
-// Dummy Proc
-void BitCompactor::btcmpctr_dummyprdct(
-                            btcmpctr_algo_args_t* algoArg
-                           )
-{
-    // Choose results which show worse performance.
-    *(algoArg->bitln) = 8;
-    *algoArg->numBytes = algoArg->blkSize;
-    for(int i = 0; i < algoArg->blkSize; i++) {
-        algoArg->residual[i] = algoArg->inAry[i];
-    }
-}
-// Uncompression function
-// Given an inBuf, Current inBuf pointer, and a state, extract specified number of bytes in outByte.
-void BitCompactor::btcmpctr_xtrct_bits(
-                   const unsigned char* inBuf,
-                         unsigned  int* inBufLen,
-                         unsigned char* state,
-                         unsigned char* outByte,
-                         unsigned char  numBits
-                        )
-{
-    unsigned char mask, thisBit;
-
-    *outByte = 0;
-    for(int i = 0; i< numBits; i++) {
-        mask    = 1 << *state;
-        thisBit = (inBuf[*inBufLen] & mask) >> *state; // Needed bit is in LSB of thisBit now.
-           *outByte |= (thisBit << i);
-        INCR_STATE_UC(state,inBufLen)
-        #ifdef __BTCMPCTR__EN_DBG__
-        mDebugStr.str(""); mDebugStr << "Extracting bits, state =" << std::to_string((int)*state)<< ", srcPtr = " << std::to_string(*inBufLen)<<", Bit = " << std::to_string(thisBit);
-        BTC_REPORT_INFO(mVerbosityLevel,6,mDebugStr.str().c_str());
-        #endif
-    }
-}
-
 // Extract header and give out, cmp, algo, bitln, eof, 8 or 16 bit to add.
-unsigned char BitCompactor::btcmpctr_xtrct_hdr(
-                           const unsigned char* inAry,
-                                 unsigned int*  inAryPtr,
-                                 unsigned char  state,
+template <int MIXED, int DUAL, int PADDED>
+void BitCompactor::btcmpctr_xtrct_hdr(
+                                 BitReaderT<PADDED>& reader,
                                  unsigned char* cmp,
                                  unsigned char* eofr,
                                  unsigned char* algo,
@@ -744,12 +1377,9 @@ unsigned char BitCompactor::btcmpctr_xtrct_hdr(
                                  unsigned char* numSyms,
                                  unsigned int*  numBytes,
                                  unsigned char* bitmap,
-                                          int   mixedBlkSize,
-                                          int   dual_encode_en,
                                  unsigned char*  dual_encode
                                 )
 {
-    unsigned char header = 0;
     // Assign default
     *eofr = 0;
     *cmp  = 0;
@@ -759,82 +1389,68 @@ unsigned char BitCompactor::btcmpctr_xtrct_hdr(
     *blkSize = 0;
     *numSyms = 0;
     *dual_encode = 0;
-    unsigned char blk;
     // First extract 2bits
-    btcmpctr_xtrct_bits(inAry,inAryPtr,&state,&header,2);
+    unsigned int header = (unsigned int)reader.get(2);
     if(header == EOFR) {
         // EOFR
         *eofr = 1;
-        return state;
+        return;
     } else if (header == CMPRSD) {
         // Compressed block
         // More header bits to extract.
         *cmp = 1;
-        if(mixedBlkSize) {
+        if(MIXED) {
             // First extract 2bits block Size
-            blk = 0;
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,&blk,2);
-            if(blk == 1) {
-                *blkSize = BIGBLKSIZE;
-            } else {
-                *blkSize = BLKSIZE;
-            }
+            *blkSize = (reader.get(2) == 1) ? BIGBLKSIZE : BLKSIZE;
         } else {
             *blkSize = BLKSIZE;
         }
     } else if (header == UNCMPRSD) {
         // Uncompressed block
-        if(mixedBlkSize) {
+        if(MIXED) {
             // First extract 2bits block Size
-            blk = 0;
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,&blk,2);
-            if(blk == 1) {
-                *blkSize = BIGBLKSIZE;
-            } else {
-                *blkSize = BLKSIZE;
-            }
+            *blkSize = (reader.get(2) == 1) ? BIGBLKSIZE : BLKSIZE;
         } else {
             *blkSize = BLKSIZE;
         }
-        return state;
+        return;
     } else {
         // Last block with bitstream length specified
         // Extract the next 6 bits, which holds the block Size in bytes.
-        btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(unsigned char *)blkSize,6);
-        return state;
-    }
-    // Next extract Algo.
-    btcmpctr_xtrct_bits(inAry,inAryPtr,&state,algo,3); // TODO Make Algo bits scalable.
-    // Extract 3 bits of bitln
-    btcmpctr_xtrct_bits(inAry,inAryPtr,&state,bitln,3);
-    // If dual encode is enabled extract 2 bits to decode dual_encode.
-    if(dual_encode_en) {
-        btcmpctr_xtrct_bits(inAry,inAryPtr,&state,dual_encode,2);
-        #ifdef DL_INC_BL
-        if(*dual_encode) {
-            // Extract 10bits of total compressed bits.
-            // Keeping it 10 to make it even.
-            unsigned char dummy_cmprsd_bits;
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,&dummy_cmprsd_bits,8);
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,&dummy_cmprsd_bits,2);
+        *blkSize = (int)reader.get(6);
+        return;
+    }
+    // Next extract Algo and 3 bits of bitln.
+    *algo  = (unsigned char)reader.get(3); // TODO Make Algo bits scalable.
+    *bitln = (unsigned char)reader.get(3);
+    // Extract the 2 bits of dual_encode. They are in every compressed 64B
+    // block, and in the compressed 4K blocks of BTC27_STREAM_V1 streams with
+    // dual encoding enabled. Only dual encoding enabled gives them a meaning.
+    if( (*blkSize == BLKSIZE) || (DUAL && mStreamVersion) ) {
+        unsigned char dual = (unsigned char)reader.get(2);
+        if(DUAL) {
+            *dual_encode = dual;
+            #ifdef DL_INC_BL
+            if(*dual_encode) {
+                // Skip 10bits of total compressed bits.
+                // Keeping it 10 to make it even.
+                reader.get(10);
+            }
+            #endif
         }
-        #endif
     }
     // Next extract 1 bytes of data_to_add
     if( (*algo == ADDPROC) || (*algo == SIGNSHFTADDPROC) ) {
-        btcmpctr_xtrct_bits(inAry,inAryPtr,&state,bytes_to_add,8);
+        *bytes_to_add = (unsigned char)reader.get(8);
     }
     if( (*algo == BINEXPPROC) ) {
         // Number of symbols is not known during decompress.
         // Needs to be in the header. 5 additional bits after the header.
         int numSymsLen = (*blkSize == BIGBLKSIZE) ? NUMSYMSBL4K : NUMSYMSBL;
-        btcmpctr_xtrct_bits(inAry,inAryPtr,&state,numSyms,numSymsLen);
+        *numSyms = (unsigned char)reader.get(numSymsLen);
         if ( (*numSyms == 0) && (numSymsLen == 4) ) { *numSyms = 16;}
         if ( (*numSyms == 0) && (numSymsLen == 6) ) { *numSyms = 64;}
-        for(int i = 0; i< *numSyms; i++) {
-            *(bytes_to_add+i) = 0;
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(bytes_to_add+i),8);
-        }
+        reader.getRun(bytes_to_add, *numSyms, 8);
     }
     if ( (*algo == BTEXPPROC) ) {
         #ifdef __BTCMPCTR__EN_DBG__
@@ -842,189 +1458,334 @@ unsigned char BitCompactor::btcmpctr_xtrct_hdr(
         BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
         #endif
         // Extract high freq symbol 8 bits.
-        btcmpctr_xtrct_bits(inAry,inAryPtr,&state,bytes_to_add,8);
+        *bytes_to_add = (unsigned char)reader.get(8);
         // Extract numBytes, 8 or 14 bits
-        *numBytes = 0;
-        unsigned char lB = 0;
-        btcmpctr_xtrct_bits(inAry,inAryPtr,&state,&lB,8);
-        *numBytes = lB;
+        *numBytes = (unsigned int)reader.get(8);
         if((*blkSize == BIGBLKSIZE)) {
             // Extract 6 more bits.
-            lB = 0;
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,&lB,6);
-            (*numBytes) |= (lB << 8);
+            (*numBytes) |= (unsigned int)reader.get(6) << 8;
         }
         #ifdef __BTCMPCTR__EN_DBG__
         mDebugStr.str(""); mDebugStr << "NumBytes is " << std::to_string(*numBytes);
         BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
         #endif
         // Extract the bitmap.
-        for(int i = 0 ; i < *blkSize; i++) {
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(bitmap + i),1);
-        }
+        reader.getBitmap(bitmap, *blkSize);
     }
     if(*dual_encode) {
         // Extract Bitmap
-        for(int i = 0 ; i < *blkSize; i++) {
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(bitmap + i),1);
+        reader.getBitmap(bitmap, *blkSize);
+    }
+}
+
+// Number of set bits in the next count bits of a bitmap, moving past them.
+static unsigned int btcmpctr_skipBitmap(BitReader& reader, int count)
+{
+    unsigned int set = 0;
+    for(; count >= 64; count -= 64) {
+        uint64_t word = reader.get(32);
+        word |= reader.get(32) << 32;
+        word = word - ((word >> 1) & 0x5555555555555555ULL);
+        word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+        word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        set += (unsigned int)((word * 0x0101010101010101ULL) >> 56);
+    }
+    for(; count > 0; count--) {
+        set += (unsigned int)reader.get(1);
+    }
+    return set;
+}
+
+// Header fields of a block, following the layout read by btcmpctr_xtrct_hdr
+// but moving past the symbol tables and bitmaps instead of extracting them.
+// payloadBits is the size of the data following the header.
+// streamVersion is btcmpctr_compress_wrap_args_t::streamVersion.
+//  return: 1 at EOFR
+template <int MIXED, int DUAL>
+static int btcmpctr_scan_hdr(BitReader&                           reader,
+                             BitCompactor::btcmpctr_block_info_t* info,
+                             unsigned long long*                  payloadBits,
+                             int                                  streamVersion
+                            )
+{
+    info->algo  = BTC27_BLOCK_UNCMPRSD;
+    info->bitln = 8;
+    info->blkSize = 0;
+    *payloadBits = 0;
+    unsigned int header = (unsigned int)reader.get(2);
+    if(header == EOFR) {
+        return 1;
+    } else if (header == LASTBLK) {
+        info->blkSize = (uint16_t)reader.get(6);
+        *payloadBits = 8ULL*info->blkSize;
+        return 0;
+    }
+    int blkSize = (MIXED && (reader.get(2) == 1)) ? BIGBLKSIZE : BLKSIZE;
+    info->blkSize = (uint16_t)blkSize;
+    if (header == UNCMPRSD) {
+        *payloadBits = 8ULL*blkSize;
+        return 0;
+    }
+    unsigned char algo  = (unsigned char)reader.get(3);
+    unsigned char bitln = (unsigned char)reader.get(3);
+    unsigned int lbitln = (bitln == 0) ? 8 : bitln;
+    unsigned char dual_encode = 0;
+    unsigned int dualBits = 0;
+    if( (blkSize == BLKSIZE) || (DUAL && streamVersion) ) {
+        unsigned char dual = (unsigned char)reader.get(2);
+        if(DUAL) {
+            dual_encode = dual;
+            #ifdef DL_INC_BL
+            if(dual_encode) {
+                // Payload bits, truncated to 10 bits for 4K blocks.
+                dualBits = (unsigned int)reader.get(10);
+            }
+            #endif
         }
     }
-    return state;
+    info->algo  = dual_encode ? (algo | BTC27_BLOCK_DUAL) : algo;
+    info->bitln = (uint8_t)lbitln;
+    if( (algo == ADDPROC) || (algo == SIGNSHFTADDPROC) ) {
+        reader.skip(8);
+    }
+    if( (algo == BINEXPPROC) ) {
+        int numSymsLen = (blkSize == BIGBLKSIZE) ? NUMSYMSBL4K : NUMSYMSBL;
+        unsigned int numSyms = (unsigned int)reader.get(numSymsLen);
+        if ( (numSyms == 0) && (numSymsLen == 4) ) { numSyms = 16;}
+        if ( (numSyms == 0) && (numSymsLen == 6) ) { numSyms = 64;}
+        reader.skip(8ULL*numSyms);
+    }
+    if ( (algo == BTEXPPROC) ) {
+        // The bytes which are not the high freq symbol follow, in 8 bits.
+        reader.skip(8);
+        unsigned int numBytes = (unsigned int)reader.get(8);
+        if((blkSize == BIGBLKSIZE)) {
+            numBytes |= (unsigned int)reader.get(6) << 8;
+        }
+        reader.skip(blkSize);
+        *payloadBits = 8ULL*numBytes;
+        if(dual_encode) {
+            reader.skip(blkSize);
+        }
+    } else if(dual_encode) {
+        // Symbols set in the bitmap are in 8 bits, the others in bitln.
+        #ifdef DL_INC_BL
+        if(blkSize == BLKSIZE) {
+            reader.skip(BLKSIZE);
+            *payloadBits = dualBits;
+            return 0;
+        }
+        #endif
+        unsigned int set = btcmpctr_skipBitmap(reader, blkSize);
+        *payloadBits = 8ULL*set + (unsigned long long)lbitln*(blkSize - set);
+    } else {
+        *payloadBits = (unsigned long long)lbitln*blkSize;
+    }
+    return 0;
+}
+
+// Transform undoing the pre-processing of a compressed block, applied
+// while the block is extracted.
+static int btcmpctr_getXfrm(unsigned char algo)
+{
+    switch(algo) {
+        case BINEXPPROC:      return BTC27_XFRM_LOOKUP;
+        case SIGNSHFTPROC:    return BTC27_XFRM_SIGNED;
+        case ADDPROC:         return BTC27_XFRM_ADD;
+        case SIGNSHFTADDPROC: return BTC27_XFRM_SIGNED_ADD;
+        default:              return BTC27_XFRM_NONE;
+    }
+}
+
+// Dual encoded extraction for one transform, resolved at compile time so the
+// per symbol loop does not branch on it.
+template<int XFRM, int PADDED>
+static void btcmpctr_xtrctDual(BitReaderT<PADDED>&  reader,
+                               unsigned int         bitln,
+                               unsigned char*       outBuf,
+                               int                  blkSize,
+                               const unsigned char* bitmap,
+                               const unsigned char* xfrmArg)
+{
+    // Lookup indices are wrapped to the table, valid streams never exceed it.
+    const unsigned int symMask = (XFRM == BTC27_XFRM_LOOKUP) ? (BTC27_LOOKUP_SIZE - 1) : 0xFF;
+    for(int cnt = 0; cnt < blkSize; cnt++) {
+        unsigned int sym = (unsigned int)reader.get(bitmap[cnt] ? 8 : bitln);
+        outBuf[cnt] = btcmpctr_xfrmSym(sym & symMask, XFRM, xfrmArg);
+    }
 }
 
 // Extract bytes with a bitmap
-unsigned char BitCompactor::btcmpctr_xtrct_bytes_wbitmap(
-                                     const unsigned char* inAry,
-                                           unsigned  int* inAryPtr,
-                                           unsigned char  state,
+template <int PADDED>
+void BitCompactor::btcmpctr_xtrct_bytes_wbitmap(
+                                           BitReaderT<PADDED>& reader,
                                            unsigned char  bitln,
                                            unsigned char* outBuf, // Assume OutBuf is BLKSIZE
                                                      int  blkSize,
-                                           unsigned char* bitmap
+                                           unsigned char* bitmap,
+                                                     int  xfrm,
+                                     const unsigned char* xfrmArg
                                          )
 {
-    int cnt = 0;
-    unsigned char lbitln = bitln;
-    while (cnt < blkSize) {
-        if (bitln == 0) { lbitln = 8; }
-        if(bitmap[cnt]) {
-            #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Extracting Byte " << std::to_string(cnt);
-            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-            #endif
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(outBuf+(cnt++)),8);
-            #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Extracted Byte "<< std::to_string((cnt-1)) <<" is "<< std::to_string(*(outBuf+cnt-1));
-            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-            #endif
-        } else {
-            #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Extracting Byte "<< std::to_string(cnt);
-            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-            #endif
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(outBuf+(cnt++)),lbitln);
-        }
+    unsigned int lbitln = (bitln == 0) ? 8 : bitln;
+    switch(xfrm) {
+        case BTC27_XFRM_LOOKUP:
+            btcmpctr_xtrctDual<BTC27_XFRM_LOOKUP,PADDED>(reader, lbitln, outBuf, blkSize, bitmap, xfrmArg);
+            break;
+        case BTC27_XFRM_SIGNED:
+            btcmpctr_xtrctDual<BTC27_XFRM_SIGNED,PADDED>(reader, lbitln, outBuf, blkSize, bitmap, xfrmArg);
+            break;
+        case BTC27_XFRM_ADD:
+            btcmpctr_xtrctDual<BTC27_XFRM_ADD,PADDED>(reader, lbitln, outBuf, blkSize, bitmap, xfrmArg);
+            break;
+        case BTC27_XFRM_SIGNED_ADD:
+            btcmpctr_xtrctDual<BTC27_XFRM_SIGNED_ADD,PADDED>(reader, lbitln, outBuf, blkSize, bitmap, xfrmArg);
+            break;
+        default:
+            btcmpctr_xtrctDual<BTC27_XFRM_NONE,PADDED>(reader, lbitln, outBuf, blkSize, bitmap, xfrmArg);
+            break;
     }
-    return state;
-
+    #ifdef __BTCMPCTR__EN_DBG__
+    for(int cnt = 0; cnt < blkSize; cnt++) {
+        mDebugStr.str(""); mDebugStr << "Extracted Byte "<< std::to_string(cnt) <<" is "<< std::to_string(outBuf[cnt]);
+        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+    }
+    #endif
 }
 
 // Expand bits to byte, given an input buffer pointing to the exact bit, and the number of bits per symbol. produce an output byte array.
-unsigned char BitCompactor::btcmpctr_xtrct_bytes(
-                              const unsigned char* inAry,
-                                    unsigned  int* inAryPtr,
-                                    unsigned char  state,
+template <int PADDED>
+void BitCompactor::btcmpctr_xtrct_bytes(
+                                    BitReaderT<PADDED>& reader,
                                     unsigned char  bitln,
                                     unsigned char* outBuf, // Assume OutBuf is BLKSIZE
                                               int  blkSize,
-                                    unsigned char  mode16
+                                              int  xfrm,
+                              const unsigned char* xfrmArg
                                   )
 {
-    // This will work for 1byte symbol extract.
-    int cnt = 0;
-    unsigned char lbitln = bitln;
-    while (cnt < blkSize) {
-        if(mode16) {
-            //construct 16bits output data
-            if (bitln == 0) { lbitln = 16; }
-            if(lbitln > 8) {
-                btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(outBuf+(cnt++)),8);
-                btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(outBuf+(cnt++)),(lbitln-8));
-            } else {
-                btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(outBuf+(cnt++)),lbitln);
-            }
-        } else {
-            if (bitln == 0) { lbitln = 8; }
-            btcmpctr_xtrct_bits(inAry,inAryPtr,&state,(outBuf+(cnt++)),lbitln);
-        }
-        #ifdef __BTCMPCTR__EN_DBG__
-        mDebugStr.str(""); mDebugStr << "Extracting Bytes, cnt =" << std::to_string(cnt);
-        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-        #endif
-    }
-    return state;
-
+    // Whole 64 symbol runs go through the per-bitln unpack kernels, which
+    // also apply the transform before storing.
+    reader.getRunXfrm(outBuf, blkSize, (bitln == 0) ? 8 : bitln, xfrm, xfrmArg);
+    #ifdef __BTCMPCTR__EN_DBG__
+    mDebugStr.str(""); mDebugStr << "Extracted Bytes, cnt =" << std::to_string(blkSize);
+    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+    #endif
 }
 
-// tosigned - oppposite of tounsigned.
-void BitCompactor::btcmpctr_tosigned(const unsigned char* inAry,
-                                           unsigned char* outBuf
-                      )
+// Static dispatch of the 64B Algo's on a full 64B block.
+void BitCompactor::btcmpctr_runAlgo64B(int algoIdx, btcmpctr_algo_args_t* algoArg)
 {
-    // if LSB == 1, then it was a signed number.
-    for(int i = 0; i < BLKSIZE; i++) {
-        #ifdef __BTCMPCTR__EN_DBG__
-        mDebugStr.str(""); mDebugStr << "Before Sign Conversion = " << std::to_string(inAry[i]);
-        BTC_REPORT_INFO(mVerbosityLevel,12,mDebugStr.str().c_str());
-        #endif
-        if((inAry[i]&1) == 1 ) {
-            outBuf[i] = (unsigned char) (~inAry[i] >> 1) | 0x80;
-        } else {
-            outBuf[i] = (unsigned char) (inAry[i] >> 1);
-        }
-        #ifdef __BTCMPCTR__EN_DBG__
-        mDebugStr.str(""); mDebugStr << "After Sign Conversion = "<< std::to_string(outBuf[i]);
-        BTC_REPORT_INFO(mVerbosityLevel,12,mDebugStr.str().c_str());
-        #endif
+    switch(algoIdx) {
+        case MINPRDCT_IDX:  btcmpctr_minprdct<BLKSIZE>(algoArg);      break;
+        case MINSPRDCT_IDX: btcmpctr_minSprdct<BLKSIZE>(algoArg);     break;
+        case MUPRDCT_IDX:   btcmpctr_muprdct<BLKSIZE>(algoArg);       break;
+        case NOPRDCT_IDX:   btcmpctr_noprdct<BLKSIZE>(algoArg);       break;
+        case NOSPRDCT_IDX:  btcmpctr_noSprdct<BLKSIZE>(algoArg);      break;
+        case MEDPRDCT_IDX:  btcmpctr_medprdct<BLKSIZE>(algoArg);      break;
+        case BINCMPCT_IDX:  btcmpctr_binCmpctprdct<BLKSIZE>(algoArg); break;
+        case BTMAP_IDX:     btcmpctr_btMapprdct<BLKSIZE>(algoArg);    break;
+        default:            break;
     }
 }
-// 16 and 8 bit adder into array.
-void BitCompactor::btcmpctr_addByte(
-             const unsigned char* data_to_add,
-                      unsigned char  mode16,
-                      unsigned char* outBuf
-                     )
+
+// Static dispatch of the 4K Algo's on a full 4K block.
+void BitCompactor::btcmpctr_runAlgo4K(int algoIdx, btcmpctr_algo_args_t* algoArg)
 {
-    int cnt = 0;
-    while(cnt < BLKSIZE) {
-        if(mode16) {
-        } else {
-            outBuf[cnt] += *data_to_add;
-            cnt++;
-        }
+    switch(algoIdx) {
+        case BINCMPCT4K_IDX: btcmpctr_binCmpctprdct<BIGBLKSIZE>(algoArg); break;
+        case BTMAP4K_IDX:    btcmpctr_btMapprdct<BIGBLKSIZE>(algoArg);    break;
+        default:             break;
     }
 }
 
+// Engines for every flag combination, indexed by
+// (mixedBlkSize << 3) | (dual_encode_en << 2) | (proc_bin_en << 1) | proc_btmap_en
+BitCompactor::CompressEngine BitCompactor::btcmpctr_getCompressEngine(const btcmpctr_compress_wrap_args_t& args)
+{
+    static const CompressEngine engines[16] = {
+        &BitCompactor::btcmpctr_CompressEngine<0,0,0,0>, &BitCompactor::btcmpctr_CompressEngine<0,0,0,1>,
+        &BitCompactor::btcmpctr_CompressEngine<0,0,1,0>, &BitCompactor::btcmpctr_CompressEngine<0,0,1,1>,
+        &BitCompactor::btcmpctr_CompressEngine<0,1,0,0>, &BitCompactor::btcmpctr_CompressEngine<0,1,0,1>,
+        &BitCompactor::btcmpctr_CompressEngine<0,1,1,0>, &BitCompactor::btcmpctr_CompressEngine<0,1,1,1>,
+        &BitCompactor::btcmpctr_CompressEngine<1,0,0,0>, &BitCompactor::btcmpctr_CompressEngine<1,0,0,1>,
+        &BitCompactor::btcmpctr_CompressEngine<1,0,1,0>, &BitCompactor::btcmpctr_CompressEngine<1,0,1,1>,
+        &BitCompactor::btcmpctr_CompressEngine<1,1,0,0>, &BitCompactor::btcmpctr_CompressEngine<1,1,0,1>,
+        &BitCompactor::btcmpctr_CompressEngine<1,1,1,0>, &BitCompactor::btcmpctr_CompressEngine<1,1,1,1>
+    };
+    return engines[btcmpctr_getCfgIdx(args)];
+}
+
+// Decoder engines, indexed by (mixedBlkSize << 1) | dual_encode_en.
+// The pre-processing enables do not change the decoding.
+BitCompactor::DecompressEngine BitCompactor::btcmpctr_getDecompressEngine(const btcmpctr_compress_wrap_args_t& args)
+{
+    static const DecompressEngine engines[4] = {
+        &BitCompactor::btcmpctr_DecompressEngine<0,0>, &BitCompactor::btcmpctr_DecompressEngine<0,1>,
+        &BitCompactor::btcmpctr_DecompressEngine<1,0>, &BitCompactor::btcmpctr_DecompressEngine<1,1>
+    };
+    return engines[btcmpctr_getCfgIdx(args) >> 2];
+}
+
+BitCompactor::DecompressEngine BitCompactor::btcmpctr_getDecompressPaddedEngine(const btcmpctr_compress_wrap_args_t& args)
+{
+    static const DecompressEngine engines[4] = {
+        &BitCompactor::btcmpctr_DecompressPaddedEngine<0,0>, &BitCompactor::btcmpctr_DecompressPaddedEngine<0,1>,
+        &BitCompactor::btcmpctr_DecompressPaddedEngine<1,0>, &BitCompactor::btcmpctr_DecompressPaddedEngine<1,1>
+    };
+    return engines[btcmpctr_getCfgIdx(args) >> 2];
+}
+
+BitCompactor::DecompressDequantEngine BitCompactor::btcmpctr_getDecompressDequantEngine(const btcmpctr_compress_wrap_args_t& args)
+{
+    static const DecompressDequantEngine engines[4] = {
+        &BitCompactor::btcmpctr_DecompressDequantEngine<0,0>, &BitCompactor::btcmpctr_DecompressDequantEngine<0,1>,
+        &BitCompactor::btcmpctr_DecompressDequantEngine<1,0>, &BitCompactor::btcmpctr_DecompressDequantEngine<1,1>
+    };
+    return engines[btcmpctr_getCfgIdx(args) >> 2];
+}
+
+BitCompactor::ScanEngine BitCompactor::btcmpctr_getScanEngine(const btcmpctr_compress_wrap_args_t& args)
+{
+    static const ScanEngine engines[4] = {
+        &BitCompactor::btcmpctr_ScanEngine<0,0>, &BitCompactor::btcmpctr_ScanEngine<0,1>,
+        &BitCompactor::btcmpctr_ScanEngine<1,0>, &BitCompactor::btcmpctr_ScanEngine<1,1>
+    };
+    return engines[btcmpctr_getCfgIdx(args) >> 2];
+}
+
+int BitCompactor::btcmpctr_getCfgIdx(const btcmpctr_compress_wrap_args_t& args)
+{
+    return ((args.mixedBlkSize   ? 1 : 0) << 3) |
+           ((args.dual_encode_en ? 1 : 0) << 2) |
+           ((args.proc_bin_en    ? 1 : 0) << 1) |
+            (args.proc_btmap_en  ? 1 : 0);
+}
+
+// The header overheads only depend on the configuration flags,
+// they are rebuilt only when the flags differ from the previous call.
 void BitCompactor::btcmpctr_initAlgosAry(const btcmpctr_compress_wrap_args_t& args)
 {
-    AlgoAry[MINPRDCT_IDX]       = &BitCompactor::btcmpctr_minprdct;
-    AlgoAry[MINSPRDCT_IDX]      = &BitCompactor::btcmpctr_minSprdct;
-    AlgoAry[MUPRDCT_IDX]        = &BitCompactor::btcmpctr_muprdct;
-    AlgoAry[MEDPRDCT_IDX]       = &BitCompactor::btcmpctr_medprdct;
-    AlgoAry[NOPRDCT_IDX]        = &BitCompactor::btcmpctr_noprdct;
-    AlgoAry[NOSPRDCT_IDX]       = &BitCompactor::btcmpctr_noSprdct;
-    if(args.proc_bin_en) {
-        AlgoAry[BINCMPCT_IDX]       = &BitCompactor::btcmpctr_binCmpctprdct;
-    } else {
-        AlgoAry[BINCMPCT_IDX]       = &BitCompactor::btcmpctr_dummyprdct;
-    }
-    if(args.proc_btmap_en) {
-        AlgoAry[BTMAP_IDX]       = &BitCompactor::btcmpctr_btMapprdct;
-    } else {
-        AlgoAry[BTMAP_IDX]       = &BitCompactor::btcmpctr_dummyprdct;
-    }
-    //4K Algo
-    if(args.proc_btmap_en) {
-        AlgoAry4K[BTMAP4K_IDX]       = &BitCompactor::btcmpctr_btMapprdct;
-    } else {
-        AlgoAry4K[BTMAP4K_IDX]       = &BitCompactor::btcmpctr_dummyprdct;
-    }
-    if(args.proc_bin_en) {
-        AlgoAry4K[BINCMPCT4K_IDX]       = &BitCompactor::btcmpctr_binCmpctprdct;
-    } else {
-        AlgoAry4K[BINCMPCT4K_IDX]       = &BitCompactor::btcmpctr_dummyprdct;
+    int cfgIdx = btcmpctr_getCfgIdx(args) | ((args.streamVersion ? 1 : 0) << 4);
+    if(cfgIdx == mAlgoAryCfg) {
+        return;
     }
+    mAlgoAryCfg = cfgIdx;
+    int mixedBlkSize   = (cfgIdx >> 3) & 1;
+    int dual_encode_en = (cfgIdx >> 2) & 1;
+    // Dual encode field of the compressed 4K blocks, BTC27_STREAM_V1 only
+    int dual_field_4k  = dual_encode_en & (cfgIdx >> 4);
     //Initialize the Header overhead.
-    AlgoAryHeaderOverhead[MINPRDCT_IDX]       = 16 + (2*args.mixedBlkSize) + (2*args.dual_encode_en); // 8bit header + 8 bit byte_to_add (minimum)
-    AlgoAryHeaderOverhead[MINSPRDCT_IDX]      = 16 + (2*args.mixedBlkSize) + (2*args.dual_encode_en); // 8bit header + 8 bit byte_to_add (minimum)
-    AlgoAryHeaderOverhead[MUPRDCT_IDX]        = 16 + (2*args.mixedBlkSize) + (2*args.dual_encode_en); // 8bit header + 8 bit byte_to_add (mu)
-    AlgoAryHeaderOverhead[MEDPRDCT_IDX]       = 16 + (2*args.mixedBlkSize) + (2*args.dual_encode_en); // 8bit header + 8 bit byte_to_add (mu)
-    AlgoAryHeaderOverhead[NOPRDCT_IDX]        = 8 + (2*args.mixedBlkSize) + (2*args.dual_encode_en);  // 8 bit header
-    AlgoAryHeaderOverhead[NOSPRDCT_IDX]       = 8 + (2*args.mixedBlkSize) + (2*args.dual_encode_en);  // 8 bit header
-    AlgoAryHeaderOverhead[BINCMPCT_IDX]       = 12 + (2*args.mixedBlkSize) + (2*args.dual_encode_en);  // 12 bit header. There is additional overhead based on the number of symbols which is dynamic
-    AlgoAryHeaderOverhead[BTMAP_IDX]          = 8+8+8+64 + (2*args.mixedBlkSize) + (2*args.dual_encode_en);  // 8 Header, 8 topBinByte,8 ByteLength,64 Bitmap
-    AlgoAryHeaderOverhead4K[BINCMPCT4K_IDX]   = 14 + (2*args.mixedBlkSize);  // 12 bit header. There is additional overhead based on the number of symbols which is dynamic
-    AlgoAryHeaderOverhead4K[BTMAP4K_IDX]      = 8+8+14+4096 + (2*args.mixedBlkSize);  // 8 Header, 8 topBinByte,14 ByteLength,4096 Bitmap
+    AlgoAryHeaderOverhead[MINPRDCT_IDX]       = 16 + (2*mixedBlkSize) + (2*dual_encode_en); // 8bit header + 8 bit byte_to_add (minimum)
+    AlgoAryHeaderOverhead[MINSPRDCT_IDX]      = 16 + (2*mixedBlkSize) + (2*dual_encode_en); // 8bit header + 8 bit byte_to_add (minimum)
+    AlgoAryHeaderOverhead[MUPRDCT_IDX]        = 16 + (2*mixedBlkSize) + (2*dual_encode_en); // 8bit header + 8 bit byte_to_add (mu)
+    AlgoAryHeaderOverhead[MEDPRDCT_IDX]       = 16 + (2*mixedBlkSize) + (2*dual_encode_en); // 8bit header + 8 bit byte_to_add (mu)
+    AlgoAryHeaderOverhead[NOPRDCT_IDX]        = 8 + (2*mixedBlkSize) + (2*dual_encode_en);  // 8 bit header
+    AlgoAryHeaderOverhead[NOSPRDCT_IDX]       = 8 + (2*mixedBlkSize) + (2*dual_encode_en);  // 8 bit header
+    AlgoAryHeaderOverhead[BINCMPCT_IDX]       = 12 + (2*mixedBlkSize) + (2*dual_encode_en);  // 12 bit header. There is additional overhead based on the number of symbols which is dynamic
+    AlgoAryHeaderOverhead[BTMAP_IDX]          = 8+8+8+64 + (2*mixedBlkSize) + (2*dual_encode_en);  // 8 Header, 8 topBinByte,8 ByteLength,64 Bitmap
+    AlgoAryHeaderOverhead4K[BINCMPCT4K_IDX]   = 14 + (2*mixedBlkSize) + (2*dual_field_4k);  // 12 bit header. There is additional overhead based on the number of symbols which is dynamic
+    AlgoAryHeaderOverhead4K[BTMAP4K_IDX]      = 8+8+14+4096 + (2*mixedBlkSize) + (2*dual_field_4k);  // 8 Header, 8 topBinByte,14 ByteLength,4096 Bitmap
 
 }
 
@@ -1058,36 +1819,252 @@ unsigned char BitCompactor::btcmpctr_get4KAlgofrmIdx(int idx)
     }
 }
 
-BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo64B(btcmpctr_algo_args_t* algoArg,
-                                                               int mixedBlkSize,
-                                                               int dual_encode_en
-                                            )
+// Returns 1 if all bytes of the block are equal to its first byte.
+static int btcmpctr_is_const_blk(const unsigned char* inAry, int blkSize)
+{
+    int isConst = 1;
+    int i = btcmpctr_kernels().constBlk(inAry, blkSize, &isConst);
+    for(; (i < blkSize) && isConst; i++) {
+        isConst = (inAry[i] == inAry[0]);
+    }
+    return isConst;
+}
+
+// Gather the block statistics needed to evaluate every predictor without
+// generating residuals: unsigned/signed extremes, signed sum and a cumulative
+// histogram of the byte values.
+void BitCompactor::btcmpctr_calc_blk_stats(const unsigned char*  inAry,
+                                                 int             blkSize,
+                                           btcmpctr_blk_stats_t* stats
+                                          )
+{
+    btcmpctr_blk_ext_t ext = {255, 0, 255, 0, 0};
+    int i = btcmpctr_kernels().blkExtremes(inAry, blkSize, &ext);
+    unsigned int umin = ext.umin, umax = ext.umax;
+    unsigned int bmin = ext.bmin, bmax = ext.bmax; // Signed extremes, biased by 0x80
+    unsigned int bsum = ext.bsum;                  // Sum of biased bytes
+    for(; i < blkSize; i++) {
+        unsigned int x = inAry[i];
+        unsigned int b = x ^ 0x80;
+        umin = std::min(umin, x);
+        umax = std::max(umax, x);
+        bmin = std::min(bmin, b);
+        bmax = std::max(bmax, b);
+        bsum += b;
+    }
+    stats->blkSize = blkSize;
+    stats->umin    = umin;
+    stats->umax    = umax;
+    stats->smin    = (signed char)(bmin ^ 0x80);
+    stats->smax    = (signed char)(bmax ^ 0x80);
+    stats->sum     = (int)bsum - (0x80 * blkSize);
+
+    // Cumulative histogram, only the [umin..umax] range can be populated.
+    uint16_t hist[256];
+    for(unsigned int v = umin; v <= umax; v++) {
+        hist[v] = 0;
+    }
+    for(i = 0; i < blkSize; i++) {
+        hist[inAry[i]]++;
+    }
+    stats->cumHist[umin] = 0;
+    for(unsigned int v = umin; v <= umax; v++) {
+        stats->cumHist[v+1] = stats->cumHist[v] + hist[v];
+    }
+}
+
+// For a predictor subtracting offset from every byte, calculate cumSyms[k], the number of
+// residuals that can be represented in k = [1..8] bits. When sign is set the residual is
+// converted to unsigned by btcmpctr_tounsigned.
+// The residuals fitting k bits are the bytes in the cyclic value range starting at
+//   offset                  (unsigned residual in [0 .. 2^k - 1])
+//   offset - 2^(k-1)        (signed residual in [-2^(k-1) .. 2^(k-1) - 1])
+// of length 2^k, which is counted from the cumulative histogram.
+void BitCompactor::btcmpctr_calc_cum_bitln(const btcmpctr_blk_stats_t* stats,
+                                                 unsigned char         offset,
+                                                 int                   sign,
+                                                 int*                  cumSyms
+                                          )
+{
+    // Number of bytes in the block with a value below v, v = [0..256]
+    auto cumCount = [stats](int v) -> int {
+        if (v <= stats->umin) {
+            return 0;
+        } else if (v > stats->umax) {
+            return stats->blkSize;
+        }
+        return stats->cumHist[v];
+    };
+    cumSyms[0] = 0;
+    for(int k = 1; k < 9; k++) {
+        int len = 1 << k;
+        int lo  = sign ? ((offset - (len >> 1)) & 0xFF) : offset;
+        int hi  = lo + len;
+        if (hi <= 256) {
+            cumSyms[k] = cumCount(hi) - cumCount(lo);
+        } else {
+            cumSyms[k] = (stats->blkSize - cumCount(lo)) + cumCount(hi - 256);
+        }
+    }
+}
+
+// Dual length compressed size from the cumulative symbol bit length counts.
+// Mirrors btcmpctr_calc_dual_bitln, including the forced long symbol.
+int BitCompactor::btcmpctr_calc_dual_cost(const int*           cumSyms,
+                                                int            blkSize,
+                                                unsigned char* bitln
+                                         )
+{
+    int compressedSize = 0;
+    for (int i = 1; i < 9; i++) {
+        int cSize = cumSyms[i]*i + (blkSize - cumSyms[i])*8;
+        if ((i == 1) || (cSize < compressedSize)) {
+            compressedSize = cSize;
+            *bitln         = i;
+        }
+    }
+    if (cumSyms[*bitln] == blkSize) {
+        compressedSize += 8 - (*bitln);
+    }
+    return compressedSize;
+}
+
+// Algo choice of the lowest compression level: only MINPRDCT, NOPRDCT and
+// NOSPRDCT are evaluated, their bit lengths follow from the block minimum and
+// maximum alone. With dual set, NOPRDCT is also evaluated dual encoded, from
+// one pass of the dual length kernel over the block, so that the zero
+// dominated blocks of sparse tensors are still compressed.
+BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgoFast64B(btcmpctr_algo_args_t* algoArg, int mixedBlkSize, int dual)
+{
+    btcmpctr_algo_choice_t algoChoice;
+    int workingBlkSize = (algoArg->blkSize);
+    int minSize = (workingBlkSize*8) + (mixedBlkSize ? 4 : 2);
+    int chosenAlgo = BITC_ALG_NONE;
+    btcmpctr_blk_ext_t ext = {255, 0, 255, 0, 0};
+    int j = btcmpctr_kernels().blkExtremes(algoArg->inAry, workingBlkSize, &ext);
+    unsigned int umin = ext.umin, umax = ext.umax;
+    unsigned int bmin = ext.bmin, bmax = ext.bmax; // Signed extremes, biased by 0x80
+    for(; j < workingBlkSize; j++) {
+        unsigned int x = algoArg->inAry[j];
+        unsigned int b = x ^ 0x80;
+        umin = std::min(umin, x);
+        umax = std::max(umax, x);
+        bmin = std::min(bmin, b);
+        bmax = std::max(bmax, b);
+    }
+    signed char smin = (signed char)(bmin ^ 0x80);
+    signed char smax = (signed char)(bmax ^ 0x80);
+    // The sign shifted value grows with the magnitude, its maximum is at smin or smax.
+    unsigned char sminU, smaxU;
+    btcmpctr_tounsigned(&smin,&sminU,1);
+    btcmpctr_tounsigned(&smax,&smaxU,1);
+    // Evaluated in index order, ties go to the lower index as in btcmpctr_ChooseAlgo64B.
+    const int fastAlgos[3]             = {MINPRDCT_IDX, NOPRDCT_IDX, NOSPRDCT_IDX};
+    const unsigned char fastMaximum[3] = {(unsigned char)(umax - umin), (unsigned char)umax, std::max(sminU, smaxU)};
+    for(int n = 0; n < 3; n++) {
+        int i = fastAlgos[n];
+        unsigned char maximum = fastMaximum[n];
+        int bitln = (maximum == 0) ? 1 : BitCompactor::mCeilLog2LUT[(maximum+1)];
+        bitln = std::max(bitln, algoArg->minFixedBitLn);
+        int cmprsdSize = AlgoAryHeaderOverhead[i] + (workingBlkSize * bitln);
+        if(cmprsdSize < minSize) {
+            minSize    = cmprsdSize;
+            chosenAlgo = i;
+        }
+    }
+    algoChoice.dual_encode    = 0;
+    if(dual) {
+        // The NOPRDCT residual is the block itself.
+        int cumSyms[9];
+        unsigned char dualBitln;
+        btcmpctr_calc_dual_cumsyms(algoArg->inAry, workingBlkSize, cumSyms);
+        #ifdef DL_INC_BL
+        int cmprsdSizeDual = AlgoAryHeaderOverhead[NOPRDCT_IDX] + btcmpctr_calc_dual_cost(cumSyms,workingBlkSize,&dualBitln) + 64 + 10;
+        #else
+        int cmprsdSizeDual = AlgoAryHeaderOverhead[NOPRDCT_IDX] + btcmpctr_calc_dual_cost(cumSyms,workingBlkSize,&dualBitln) + 64;
+        #endif
+        if(cmprsdSizeDual < minSize) {
+            minSize    = cmprsdSizeDual;
+            chosenAlgo = NOPRDCT_IDX;
+            algoChoice.dual_encode = 1;
+        }
+    }
+    algoChoice.algoIdx        = chosenAlgo;
+    algoChoice.none           = (chosenAlgo == BITC_ALG_NONE);
+    algoChoice.algoHeader     = btcmpctr_getAlgofrmIdx(chosenAlgo);
+    algoChoice.cmprsdSize     = minSize;
+    algoChoice.algoType       = 0;
+    algoChoice.workingBlkSize = workingBlkSize;
+    if(!algoChoice.none) {
+        btcmpctr_runAlgo64B(chosenAlgo,algoArg);
+        if(algoChoice.dual_encode) {
+            int dualCpSize;
+            btcmpctr_calc_dual_bitln(algoArg->residual,algoArg->bitln,workingBlkSize,algoArg->bitmap,&dualCpSize);
+        }
+    }
+    return algoChoice;
+}
+
+template <int MIXED, int DUAL>
+BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo64B(btcmpctr_algo_args_t* algoArg)
 {
+    if(algoArg->level <= BTC27_LEVEL_FAST) {
+        return btcmpctr_ChooseAlgoFast64B(algoArg,MIXED,DUAL);
+    }
+
     btcmpctr_algo_choice_t algoChoice;
     int minSize, minSizeDual;
     int chosenAlgo, chosenAlgoDual(0);
     int workingBlkSize = (algoArg->blkSize);
     int cmprsdSize, cmprsdSizeDual(0), dualCpSize;
-    unsigned char dualBitln;
-    unsigned char bitmap[BLKSIZE];
-
-    minSize        = (workingBlkSize*8) + (mixedBlkSize ? 4 : 2);
-    minSizeDual    = (workingBlkSize*8) + (mixedBlkSize ? 4 : 2);
+    unsigned char bitln, dualBitln;
+    int cumSyms[9];
+    unsigned char offset[BTC27_NUMALGO];
+    int sign[BTC27_NUMALGO];
+    btcmpctr_blk_stats_t stats;
+    // Dual encoding is searched for every Algo at the highest level, below it
+    // only for NOPRDCT, whose dual cost catches the zero dominated blocks.
+    const int dualMask = !DUAL ? 0 : (algoArg->level >= BTC27_LEVEL_MAX) ? ~0 : (1 << NOPRDCT_IDX);
+
+    minSize        = (workingBlkSize*8) + (MIXED ? 4 : 2);
+    minSizeDual    = (workingBlkSize*8) + (MIXED ? 4 : 2);
     chosenAlgo     = BITC_ALG_NONE;
     chosenAlgoDual = BITC_ALG_NONE;
-    *(algoArg->bitln)       = 8;
-    // Run Through the 64B Algo's, except BINCMPCT_IDX and BTMAP_IDX (disabled)
-    for(int i = 0; i< (BTC27_NUMALGO - 2); i++) {
+
+    // Single pass over the block, all predictors are evaluated from its statistics.
+    btcmpctr_calc_blk_stats(algoArg->inAry, workingBlkSize, &stats);
+    double mud = ((double)stats.sum)/workingBlkSize;
+    offset[MINPRDCT_IDX]  = stats.umin;                              sign[MINPRDCT_IDX]  = 0;
+    offset[MINSPRDCT_IDX] = (unsigned char)stats.smin;               sign[MINSPRDCT_IDX] = 1;
+    offset[MUPRDCT_IDX]   = (unsigned char)(signed char)(round(mud)); sign[MUPRDCT_IDX]   = 1;
+    offset[NOPRDCT_IDX]   = 0;                                       sign[NOPRDCT_IDX]   = 0;
+    offset[NOSPRDCT_IDX]  = 0;                                       sign[NOSPRDCT_IDX]  = 1;
+    offset[MEDPRDCT_IDX]  = ((algoArg->algoMask >> MEDPRDCT_IDX) & 1) ? getMedianHist(&stats) : 0;
+                                                                     sign[MEDPRDCT_IDX]  = 1;
+
+    // Evaluate the 64B Algo's in algoMask, except BINCMPCT_IDX and BTMAP_IDX (disabled)
+    for(int i = 0; i< NUMPRDCT; i++) {
+        if(!((algoArg->algoMask >> i) & 1)) {
+            continue;
+        }
         #ifdef __BTCMPCTR__EN_DBG__
-        mDebugStr.str(""); mDebugStr << "Calling Algo "<< std::to_string(i);
+        mDebugStr.str(""); mDebugStr << "Evaluating Algo "<< std::to_string(i);
         BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
         #endif
-        (this->*AlgoAry[i])(algoArg);
-        // If BTMAP_IDX then multiple is numBytes
+        btcmpctr_calc_cum_bitln(&stats,offset[i],sign[i],cumSyms);
+        // Same as btcmpctr_calc_bitln: smallest length that fits all residuals.
+        bitln = 1;
+        while (cumSyms[bitln] < workingBlkSize) {
+            bitln++;
+        }
+        if ( bitln < algoArg->minFixedBitLn ) {
+            bitln = algoArg->minFixedBitLn;
+        }
         int numBytes = workingBlkSize;
-        cmprsdSize = AlgoAryHeaderOverhead[i] + (numBytes * (*(algoArg->bitln))) ;
-        if((dual_encode_en) & (i != BTMAP4K_IDX) ) {
-            btcmpctr_calc_dual_bitln(algoArg->residual,&dualBitln,workingBlkSize,(unsigned char*)bitmap,&dualCpSize);
+        cmprsdSize = AlgoAryHeaderOverhead[i] + (numBytes * bitln) ;
+        const int evalDual = ((dualMask >> i) & 1) && (i != BTMAP4K_IDX);
+        if(evalDual) {
+            dualCpSize = btcmpctr_calc_dual_cost(cumSyms,workingBlkSize,&dualBitln);
             #ifdef DL_INC_BL
             cmprsdSizeDual = AlgoAryHeaderOverhead[i] + dualCpSize + 64 + 10;
             #else
@@ -1106,7 +2083,10 @@ BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo64B(btcmpc
         mDebugStr.str(""); mDebugStr << "Dual Compressed Size in bits is "<< std::to_string(cmprsdSizeDual);
         BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
         #endif
-        if((cmprsdSizeDual < minSizeDual) && dual_encode_en && (i != BTMAP4K_IDX)) {
+        if(algoArg->algoSize) {
+            algoArg->algoSize[i] = evalDual ? std::min(cmprsdSize,cmprsdSizeDual) : cmprsdSize;
+        }
+        if((cmprsdSizeDual < minSizeDual) && evalDual) {
             minSizeDual    = cmprsdSizeDual;
             chosenAlgoDual = i;
         }
@@ -1115,7 +2095,7 @@ BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo64B(btcmpc
     mDebugStr.str(""); mDebugStr << "Chosen Algo is "<< std::to_string(chosenAlgo) << ",";
     BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
     #endif
-    if((minSizeDual < minSize) && dual_encode_en) {
+    if((minSizeDual < minSize) && dualMask) {
         // Choose Dual Mode encoding
         algoChoice.dual_encode = 1;
     } else {
@@ -1125,16 +2105,163 @@ BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo64B(btcmpc
     mDebugStr.str(""); mDebugStr << "Dual Encode Mode is  "<< std::to_string(algoChoice.dual_encode) <<",";
     BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
     #endif
-    algoChoice.none       = algoChoice.dual_encode ? (chosenAlgoDual == BITC_ALG_NONE) : (chosenAlgo == BITC_ALG_NONE);
-    algoChoice.algoHeader = btcmpctr_getAlgofrmIdx(algoChoice.dual_encode ? chosenAlgoDual : chosenAlgo);
-    algoChoice.chosenAlgo = algoChoice.none ? &BitCompactor::btcmpctr_dummyprdct : (AlgoAry[algoChoice.dual_encode ? chosenAlgoDual : chosenAlgo]);
+    algoChoice.algoIdx    = algoChoice.dual_encode ? chosenAlgoDual : chosenAlgo;
+    algoChoice.none       = (algoChoice.algoIdx == BITC_ALG_NONE);
+    algoChoice.algoHeader = btcmpctr_getAlgofrmIdx(algoChoice.algoIdx);
     algoChoice.cmprsdSize = algoChoice.dual_encode ? minSizeDual : minSize;
     algoChoice.algoType   = 0;
     algoChoice.workingBlkSize = workingBlkSize;
+
+    // Run the chosen Algo once, its residual, bitln, minimum and bitmap are
+    // kept in algoArg for the emit phase.
+    if(!algoChoice.none) {
+        btcmpctr_runAlgo64B(algoChoice.algoIdx,algoArg);
+        if(algoChoice.dual_encode) {
+            btcmpctr_calc_dual_bitln(algoArg->residual,algoArg->bitln,workingBlkSize,algoArg->bitmap,&dualCpSize);
+        }
+    }
     return algoChoice;
 
 }
 
+// Adaptive predictor pruning. Within a tensor the same predictors win for long
+// runs of blocks, so only the ADAPT_NUMLIKELY most frequent recent winners are
+// evaluated. Every ADAPT_PERIOD blocks, after a block whose size regressed, and
+// while the estimated ratio loss is above maxLoss percent, a block is fully
+// evaluated. Full evaluations sample the loss of the pruned choice. If most
+// blocks of an ADAPT_DECAY period were fully evaluated, the pruning saves no
+// work, and the next period is fully evaluated without tracking.
+template <int MIXED, int DUAL>
+BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgoAdapt64B(btcmpctr_algo_args_t* algoArg,
+                                                                             btcmpctr_adapt_t*     adapt,
+                                                                             int                   maxLoss
+                                                                            )
+{
+    if(adapt->disabled) {
+        if(++adapt->numBlks >= ADAPT_DECAY) {
+            // Retry, starting with a full evaluation.
+            btcmpctr_adapt_init(adapt);
+        }
+        return btcmpctr_ChooseAlgo64B<MIXED,DUAL>(algoArg);
+    }
+    int algoSize[BTC27_NUMALGO];
+    int fullEval = adapt->forceFull || (adapt->sinceFull >= ADAPT_PERIOD) ||
+                   ((adapt->lossBits * 100) > ((long long)maxLoss * adapt->sampledBits));
+    algoArg->algoMask = fullEval ? PRDCT_MASK_ALL : adapt->likelyMask;
+    algoArg->algoSize = fullEval ? algoSize : nullptr;
+    btcmpctr_algo_choice_t algoChoice = btcmpctr_ChooseAlgo64B<MIXED,DUAL>(algoArg);
+    algoArg->algoMask = PRDCT_MASK_ALL;
+    algoArg->algoSize = nullptr;
+    #ifdef __BTCMPCTR__EN_DBG__
+    mDebugStr.str(""); mDebugStr << "Adaptive pruning, full evaluation = "<< std::to_string(fullEval) << ", Algo mask = "<< std::to_string(adapt->likelyMask);
+    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+    #endif
+    btcmpctr_adapt_update(adapt,algoChoice,fullEval ? algoSize : nullptr,(algoArg->blkSize*8) + (MIXED ? 4 : 2));
+    return algoChoice;
+}
+
+void BitCompactor::btcmpctr_adapt_init(btcmpctr_adapt_t* adapt)
+{
+    memset(adapt, 0, sizeof(*adapt));
+    adapt->sinceFull = ADAPT_PERIOD;
+}
+
+// algoSize is set after a full evaluation, noneSize is the uncompressed block size.
+void BitCompactor::btcmpctr_adapt_update(btcmpctr_adapt_t*             adapt,
+                                         const btcmpctr_algo_choice_t& choice,
+                                         const int*                    algoSize,
+                                         int                           noneSize
+                                        )
+{
+    if(!choice.none) {
+        adapt->wins[choice.algoIdx]++;
+    }
+    if(algoSize) {
+        if(adapt->likelyMask) {
+            int prunedSize = noneSize;
+            for(int i = 0; i < NUMPRDCT; i++) {
+                if((adapt->likelyMask >> i) & 1) {
+                    prunedSize = std::min(prunedSize, algoSize[i]);
+                }
+            }
+            adapt->lossBits    += prunedSize - choice.cmprsdSize;
+            adapt->sampledBits += choice.cmprsdSize;
+        }
+        adapt->avgSize  += (choice.cmprsdSize - adapt->avgSize) / 8;
+        adapt->numFull++;
+        // Most frequent recent winners, ties go to the lower index. Only
+        // ranked on the periodic evaluations, or if the winner was pruned.
+        if((adapt->sinceFull >= ADAPT_PERIOD) || (!choice.none && !((adapt->likelyMask >> choice.algoIdx) & 1))) {
+            adapt->likelyMask = 0;
+            for(int n = 0; n < ADAPT_NUMLIKELY; n++) {
+                int best = -1;
+                for(int i = 0; i < NUMPRDCT; i++) {
+                    if(!((adapt->likelyMask >> i) & 1) && ((best < 0) || (adapt->wins[i] > adapt->wins[best]))) {
+                        best = i;
+                    }
+                }
+                adapt->likelyMask |= (1 << best);
+            }
+        }
+        adapt->sinceFull = 0;
+        adapt->forceFull = 0;
+    } else {
+        adapt->sinceFull++;
+        adapt->forceFull = ((choice.cmprsdSize * 8) > (adapt->avgSize * 9));
+    }
+    if(++adapt->numBlks >= ADAPT_DECAY) {
+        for(int i = 0; i < BTC27_NUMALGO; i++) {
+            adapt->wins[i] >>= 1;
+        }
+        adapt->lossBits    >>= 1;
+        adapt->sampledBits >>= 1;
+        adapt->disabled = (adapt->numFull > ADAPT_MAXFULL);
+        adapt->numBlks = 0;
+        adapt->numFull = 0;
+    }
+}
+
+// Constant 64B blocks (all zero blocks included): the choice and the output of
+// the chosen Algo only depend on the value. The first block of a value goes
+// through btcmpctr_ChooseAlgo64B and the result is kept in constBlk, the
+// following blocks with the same value are filled in from it.
+template <int MIXED, int DUAL>
+BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgoConst64B(btcmpctr_algo_args_t* algoArg,
+                                                                    btcmpctr_const_blk_t* constBlk
+                                                 )
+{
+    int workingBlkSize = (algoArg->blkSize);
+    if(!constBlk->valid) {
+        constBlk->choice   = btcmpctr_ChooseAlgo64B<MIXED,DUAL>(algoArg);
+        constBlk->bitln    = *algoArg->bitln;
+        constBlk->minimum  = algoArg->minimum[0];
+        constBlk->residual = algoArg->residual[0];
+        constBlk->bitmap0  = algoArg->bitmap[0];
+        constBlk->bitmap1  = algoArg->bitmap[1];
+        constBlk->valid    = 1;
+        return constBlk->choice;
+    }
+    #ifdef __BTCMPCTR__EN_DBG__
+    mDebugStr.str(""); mDebugStr << "Constant block of value "<< std::to_string(algoArg->inAry[0]) << ", reusing Algo "<< std::to_string(constBlk->choice.algoIdx);
+    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+    #endif
+    if(!constBlk->choice.none) {
+        *algoArg->bitln     = constBlk->bitln;
+        algoArg->minimum[0] = constBlk->minimum;
+        memset(algoArg->residual, constBlk->residual, workingBlkSize);
+        if(constBlk->choice.dual_encode) {
+            // Every residual is equal, only bitmap[0] can differ (forced long symbol).
+            memset(algoArg->bitmap, constBlk->bitmap1, workingBlkSize);
+            algoArg->bitmap[0] = constBlk->bitmap0;
+        }
+    }
+    return constBlk->choice;
+}
+
+// The 4K Algo's are costed from the block histogram without being run: binning
+// only depends on the number of distinct symbols and the bitmap on the count of
+// the most frequent symbol. The caller runs the chosen Algo if the 4K block is used.
+template <int BIN, int BTMAP>
 BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo4K(btcmpctr_algo_args_t* algoArg,
                                                               int mixedBlkSize
                                            )
@@ -1144,29 +2271,52 @@ BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo4K(btcmpct
     int chosenAlgo;
     int workingBlkSize = (algoArg->blkSize);
     int cmprsdSize;
+    btcmpctr_blk_stats_t stats;
+    int numDistinct = 0;
+    int maxSymFreq  = 0;
+
+    if(btcmpctr_is_const_blk(algoArg->inAry, workingBlkSize)) {
+        numDistinct = 1;
+        maxSymFreq  = workingBlkSize;
+    } else {
+        btcmpctr_calc_blk_stats(algoArg->inAry, workingBlkSize, &stats);
+        for(int v = stats.umin; v <= stats.umax; v++) {
+            int symbFreq = stats.cumHist[v+1] - stats.cumHist[v];
+            numDistinct += (symbFreq > 0);
+            maxSymFreq   = std::max(maxSymFreq, symbFreq);
+        }
+    }
 
     minSize     = (workingBlkSize*8) + (mixedBlkSize ? 4 : 2);
     chosenAlgo  = BITC_ALG_NONE;
-    *(algoArg->bitln)       = 8;
-    // Run Through the 64B Algo's
+    // Run Through the 4K Algo's
     for(int i = 0; i< BTC27_NUM4KALGO; i++) {
         #ifdef __BTCMPCTR__EN_DBG__
-        mDebugStr.str(""); mDebugStr << "Calling Algo "<< std::to_string(i);
+        mDebugStr.str(""); mDebugStr << "Evaluating Algo "<< std::to_string(i);
         BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
         #endif
-        (this->*AlgoAry4K[i])(algoArg);
-        int numBytes = workingBlkSize;
-        if(i == BTMAP4K_IDX) {
-            numBytes = *(algoArg->numBytes);
+        if( ((i == BINCMPCT4K_IDX) && !BIN) || ((i == BTMAP4K_IDX) && !BTMAP) ) {
+            // Disabled, never smaller than uncompressed.
+            continue;
+        }
+        if(i == BINCMPCT4K_IDX) {
+            // Same as btcmpctr_binCmpctprdct: residuals are bin indices [0..numSyms-1]
+            int numSyms = std::min(numDistinct, MAXSYMS4K);
+            int bitln   = 8;
+            if(numDistinct <= MAXSYMS4K) {
+                bitln = (numSyms == 1) ? 1 : BitCompactor::mCeilLog2LUT[numSyms];
+                bitln = std::max(bitln, algoArg->minFixedBitLn);
+            }
+            cmprsdSize = AlgoAryHeaderOverhead4K[i] + (workingBlkSize * bitln) + (numSyms*8);
+        } else {
+            // Same as btcmpctr_btMapprdct: 8 bits per byte other than the top symbol
+            int numBytes = workingBlkSize - maxSymFreq;
+            cmprsdSize = AlgoAryHeaderOverhead4K[i] + (numBytes * 8);
         }
-        cmprsdSize = AlgoAryHeaderOverhead4K[i] + (numBytes * (*(algoArg->bitln)));
         #ifdef __BTCMPCTR__EN_DBG__
         mDebugStr.str(""); mDebugStr << "Compressed Size in bits is "<< std::to_string(cmprsdSize);
         BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
         #endif
-        if(i == BINCMPCT4K_IDX) {
-            cmprsdSize += ((*(algoArg->numSyms))*8);
-        }
         if(cmprsdSize < minSize) {
             minSize = cmprsdSize;
             chosenAlgo = i;
@@ -1178,14 +2328,9 @@ BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo4K(btcmpct
     #endif
     algoChoice.algoHeader = btcmpctr_get4KAlgofrmIdx(chosenAlgo);
 
-    // @ajgorman: KW fix
-    if (chosenAlgo == BITC_ALG_NONE) {
-        algoChoice.none = 0x1;
-        algoChoice.chosenAlgo = nullptr; // should never be used if 'none' is asserted
-    } else {
-        algoChoice.none = 0x0;
-        algoChoice.chosenAlgo = AlgoAry4K[chosenAlgo]; // chosenAlgo should be < NUM4KALGO
-    }
+    // chosenAlgo is either < NUM4KALGO or BITC_ALG_NONE
+    algoChoice.algoIdx = chosenAlgo;
+    algoChoice.none    = (chosenAlgo == BITC_ALG_NONE) ? 0x1 : 0x0;
 
     algoChoice.cmprsdSize = minSize;
     algoChoice.algoType   = 1;
@@ -1194,6 +2339,27 @@ BitCompactor::btcmpctr_algo_choice_t BitCompactor::btcmpctr_ChooseAlgo4K(btcmpct
     return algoChoice;
 }
 
+// Bypass: insert every block of a superblock uncompressed, no Algo is evaluated.
+// A full superblock is a single 4K block when mixed block size is enabled, otherwise
+// the superblock is split in 64B blocks, the last one possibly shorter.
+void BitCompactor::btcmpctr_insrt_bypass(BitWriter&           writer,
+                                         const unsigned char* inAry,
+                                         int                  bigBlkSize,
+                                         int                  mixedBlkSize
+                                        )
+{
+    if(mixedBlkSize && (bigBlkSize == BIGBLKSIZE)) {
+        btcmpctr_insrt_hdr(writer, BITC_ALG_NONE, 8, 0, BIGBLKSIZE, mixedBlkSize, 0);
+        writer.insertBytes(inAry, BIGBLKSIZE);
+        return;
+    }
+    for(int smCntr = 0; smCntr < bigBlkSize; smCntr += BLKSIZE) {
+        int workingBlkSize = std::min(BLKSIZE, bigBlkSize - smCntr);
+        btcmpctr_insrt_hdr(writer, BITC_ALG_NONE, 8, 0, workingBlkSize, mixedBlkSize, 0);
+        writer.insertBytes(inAry + smCntr, workingBlkSize);
+    }
+}
+
 //Compress Wrap
 //This is a SWIG/numpy integration friendly interface for the compression function.
 //
@@ -1215,323 +2381,398 @@ unsigned int BitCompactor::CompressArray(const unsigned char* const
     }
 }
 
-int BitCompactor::CompressWrap(const unsigned char*                 src,
-                               unsigned int                         srcLen,
-                               unsigned char*                       dst,
-                               unsigned int&                        dstLen, // dstLen holds the size of the output buffer.
-                               const btcmpctr_compress_wrap_args_t& args
-                           )
+// Compression engine, specialized on the configuration flags so that the
+// per block loops carry no runtime configuration checks.
+// The buffers and the output size bound are checked by CompressWrap.
+template <int MIXED, int DUAL, int BIN, int BTMAP>
+int BitCompactor::btcmpctr_CompressEngine(const unsigned char*                 src,
+                                          unsigned int                         srcLen,
+                                          unsigned char*                       dst,
+                                          unsigned int&                        dstLen,
+                                          const btcmpctr_compress_wrap_args_t& args
+                                         )
 {
-    mVerbosityLevel = args.verbosity;
-    if(src && dst)
-    {
-        // Check if output buffer is big enough for compressed data worst case
-        unsigned int boundSize = this->GetCompressedSizeBound(srcLen);
-        if(boundSize <= dstLen)
-        {
-            btcmpctr_initAlgosAry(args);
-            // Keep a copy of the destination buffer size allocated
-            // to be used in checks. The final destination size will
-            // be returned in this pointer.
-
-            unsigned char bitln;
-            unsigned char minimum[MAXSYMS4K];
-            int cmprsdSize, workingBlkSize,dualCpSize;
-            unsigned int srcCnt = 0, dstCnt = 0;
-            int chosenAlgo;
-            int state = 0;
-            int blkCnt = 0;
-            int numSyms = 0;
-            unsigned char residual[BIGBLKSIZE];
-            unsigned char bitmap[BIGBLKSIZE];
-            int numBytes;
-            unsigned int accum = 0;
-            btcmpctr_algo_args_t algoArg;
-            btcmpctr_algo_choice_t chosenAlgos[BIGBLKSIZE/BLKSIZE] = {0};
-            btcmpctr_algo_choice_t chosenAlgos4K = {};
-            int smCntr = 0;
-            int numSmBlks = 0;
-            int bigBlkSize;
-
-            // Choose the correct Algo to run.
+    // Per superblock scratch area. The selection phase keeps the output
+    // of the chosen algo of every block here, the emit phase only
+    // serializes it.
+    //   64B blocks : block n at residual/bitmap offset n*BLKSIZE
+    //   4K blocks  : the chosen 4K algo, run only when the 4K block is used
+    unsigned char residual[BIGBLKSIZE];
+    unsigned char bitmap[BIGBLKSIZE];
+    unsigned char minimum[BIGBLKSIZE/BLKSIZE][MAXSYMS];
+    unsigned char bitln[BIGBLKSIZE/BLKSIZE];
+    int numSyms[BIGBLKSIZE/BLKSIZE];
+    int numBytes[BIGBLKSIZE/BLKSIZE];
+    unsigned char residual4K[BIGBLKSIZE];
+    unsigned char bitmap4K[BIGBLKSIZE];
+    unsigned char minimum4K[MAXSYMS4K];
+    unsigned char bitln4K;
+    int numSyms4K;
+    int numBytes4K;
+    btcmpctr_algo_args_t algoArgs[BIGBLKSIZE/BLKSIZE];
+    btcmpctr_algo_args_t algoArg4K;
+    // Choices made for constant 64B blocks, by value.
+    btcmpctr_const_blk_t constBlks[256];
+    for(int n = 0; n < 256; n++) {
+        constBlks[n].valid = 0;
+    }
+
+    int cmprsdSize, workingBlkSize;
+    unsigned int srcCnt = 0;
+    int chosenAlgo;
+    int blkCnt = 0;
+    BitWriter writer(dst);
+    btcmpctr_algo_choice_t chosenAlgos[BIGBLKSIZE/BLKSIZE] = {0};
+    btcmpctr_algo_choice_t chosenAlgos4K = {};
+    int smCntr = 0;
+    int numSmBlks = 0;
+    int bigBlkSize;
+
+    // Choose the correct Algo to run.
+    #ifdef __BTCMPCTR__EN_DBG__
+    mDebugStr.str(""); mDebugStr << "Source Length = "<< std::to_string(srcLen);
+    BTC_REPORT_INFO(mVerbosityLevel,1,mDebugStr.str().c_str());
+    #endif
+    for(int n = 0; n < (BIGBLKSIZE/BLKSIZE); n++) {
+        algoArgs[n].minimum  = minimum[n];
+        algoArgs[n].bitln    = &bitln[n];
+        algoArgs[n].numSyms  = &numSyms[n];
+        algoArgs[n].bitmap   = bitmap + (n*BLKSIZE);
+        algoArgs[n].numBytes = &numBytes[n];
+        algoArgs[n].residual = residual + (n*BLKSIZE);
+        algoArgs[n].minFixedBitLn = args.minFixedBitLn;
+        algoArgs[n].level         = args.level;
+        algoArgs[n].algoMask      = PRDCT_MASK_ALL;
+        algoArgs[n].algoSize      = nullptr;
+    }
+    algoArg4K.minimum  = minimum4K;
+    algoArg4K.bitln    = &bitln4K;
+    algoArg4K.numSyms  = &numSyms4K;
+    algoArg4K.bitmap   = bitmap4K;
+    algoArg4K.numBytes = &numBytes4K;
+    algoArg4K.residual = residual4K;
+    algoArg4K.minFixedBitLn = args.minFixedBitLn;
+    algoArg4K.level         = args.level;
+    algoArg4K.algoMask      = PRDCT_MASK_ALL;
+    algoArg4K.algoSize      = nullptr;
+    // Adaptive predictor pruning, the fast level has nothing to prune.
+    int adaptEn = args.adaptive_en && (args.level > BTC27_LEVEL_FAST);
+    btcmpctr_adapt_t adapt;
+    btcmpctr_adapt_init(&adapt);
+
+    // Lower bound of the compressed size of a 64B block: cheapest header with
+    // every symbol in minFixedBitLn (at least 1) bits, or in dual mode 63 1-bit
+    // symbols and one forced 8-bit symbol. Once the 64B blocks evaluated so far
+    // plus this bound for the rest reach the 4K size, the 4K block is chosen
+    // and the remaining 64B blocks are not evaluated.
+    int minCmprsdSize64B = std::min((BLKSIZE*8) + (MIXED ? 4 : 2),
+                                    AlgoAryHeaderOverhead[NOPRDCT_IDX] + (BLKSIZE * std::max(args.minFixedBitLn, 1)));
+    if(DUAL) {
+        #ifdef DL_INC_BL
+        minCmprsdSize64B = std::min(minCmprsdSize64B, AlgoAryHeaderOverhead[NOPRDCT_IDX] + (BLKSIZE - 1) + 8 + 64 + 10);
+        #else
+        minCmprsdSize64B = std::min(minCmprsdSize64B, AlgoAryHeaderOverhead[NOPRDCT_IDX] + (BLKSIZE - 1) + 8 + 64);
+        #endif
+    }
+
+    while (srcCnt < srcLen) {
+        if( (srcCnt + BIGBLKSIZE) > srcLen) {
+            bigBlkSize = (srcLen - srcCnt);
+        } else {
+            bigBlkSize = BIGBLKSIZE;
+        }
+        if(args.bypass_en) {
+            btcmpctr_insrt_bypass(writer, (src + srcCnt), bigBlkSize, MIXED);
+            srcCnt += bigBlkSize;
+            blkCnt++;
+            continue;
+        }
+        // Choose 4K Algorithm, not searched at the lowest level.
+        int evalBigBlk = (bigBlkSize == BIGBLKSIZE) && MIXED && (args.level > BTC27_LEVEL_FAST);
+        if(evalBigBlk) {
+           algoArg4K.inAry   = (src + srcCnt);
+           algoArg4K.blkSize = bigBlkSize;
+           chosenAlgos4K = btcmpctr_ChooseAlgo4K<BIN,BTMAP>(&algoArg4K,MIXED);
+        }
+
+        // Work on the 64B block size.
+        cmprsdSize = 0;
+        smCntr = 0;
+        numSmBlks = 0;
+        int bigBlkWins = 0;
+        while(smCntr < bigBlkSize) {
+            if(evalBigBlk && ((cmprsdSize + ((bigBlkSize - smCntr)/BLKSIZE)*minCmprsdSize64B) >= chosenAlgos4K.cmprsdSize)) {
+                // The 64B blocks can no longer be smaller than the 4K block.
+                bigBlkWins = 1;
+                break;
+            }
+
+            if( (smCntr + BLKSIZE) > bigBlkSize) {
+                workingBlkSize = (bigBlkSize - smCntr);
+            } else {
+                workingBlkSize = BLKSIZE;
+            }
+            algoArgs[numSmBlks].inAry = (src + srcCnt + smCntr);
+            algoArgs[numSmBlks].blkSize = workingBlkSize;
+            // Call the Algo Choice.
             #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Source Length = "<< std::to_string(srcLen);
-            BTC_REPORT_INFO(mVerbosityLevel,1,mDebugStr.str().c_str());
+            mDebugStr.str(""); mDebugStr << "Trying to find best algo for this blockCnt = "<< std::to_string(blkCnt);
+            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
             #endif
-            algoArg.minimum  = (unsigned char *)&minimum;
-            algoArg.bitln    = &bitln;
-            algoArg.numSyms  = &numSyms;
-            algoArg.bitmap   = (unsigned char *)&bitmap;
-            algoArg.numBytes = &numBytes;
-            algoArg.residual = (unsigned char *)&residual;
-            algoArg.minFixedBitLn = args.minFixedBitLn;
-
-            while (srcCnt < srcLen) {
-                if( (srcCnt + BIGBLKSIZE) > srcLen) {
-                    bigBlkSize = (srcLen - srcCnt);
+            chosenAlgos[numSmBlks].workingBlkSize = workingBlkSize;
+            if (workingBlkSize == BLKSIZE) {
+                if (btcmpctr_is_const_blk(algoArgs[numSmBlks].inAry,workingBlkSize)) {
+                    chosenAlgos[numSmBlks] = btcmpctr_ChooseAlgoConst64B<MIXED,DUAL>(&algoArgs[numSmBlks],&constBlks[algoArgs[numSmBlks].inAry[0]]);
+                } else if (adaptEn) {
+                    chosenAlgos[numSmBlks] = btcmpctr_ChooseAlgoAdapt64B<MIXED,DUAL>(&algoArgs[numSmBlks],&adapt,args.adaptiveMaxLoss);
                 } else {
-                    bigBlkSize = BIGBLKSIZE;
-                }
-                // Choose 4K Algorithm
-                if((bigBlkSize == BIGBLKSIZE) && args.mixedBlkSize) {
-                   algoArg.inAry = (src + srcCnt);
-                   algoArg.blkSize = bigBlkSize;
-                   chosenAlgos4K = btcmpctr_ChooseAlgo4K(&algoArg,args.mixedBlkSize);
+                    chosenAlgos[numSmBlks] = btcmpctr_ChooseAlgo64B<MIXED,DUAL>(&algoArgs[numSmBlks]);
                 }
+                #ifdef __BTCMPCTR__EN_DBG__
+                mDebugStr.str(""); mDebugStr << " blkCnt = "<< std::to_string(blkCnt);
+                BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+                #endif
+            }
+            cmprsdSize += chosenAlgos[numSmBlks].cmprsdSize;
+            numSmBlks++;
+            smCntr += workingBlkSize;
+            #ifdef __BTCMPCTR__EN_DBG__
+            mDebugStr.str(""); mDebugStr << "bigBlkSize = "<< std::to_string(bigBlkSize)<< ", smCntr = "<< std::to_string(smCntr) << ", numSmBlks = "<< std::to_string(numSmBlks);
+            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+            #endif
+        }
+        // IF    Compressed size of 4K block < totoal comporessed size of 64B blocks, and if this is not the last <4K block. and if mixed Block size is enabled.
+        if( (((chosenAlgos4K.cmprsdSize <= cmprsdSize) && evalBigBlk) || bigBlkWins) && MIXED) {
+            //---------------------------------------------------------------------------------
+            // Chosen 4K Blocks
+            //---------------------------------------------------------------------------------
+            #ifdef __BTCMPCTR__EN_DBG__
+            mDebugStr.str(""); mDebugStr << "Emitting chosen algo";
+            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+            #endif
+            if (chosenAlgos4K.workingBlkSize < BIGBLKSIZE) {
+                // Force an Algo for the last block.
+                chosenAlgos4K.none = 1;
+            }
+            const btcmpctr_algo_args_t* result = nullptr;
+            unsigned char blkBitln = 8;
+            if(chosenAlgos4K.none != 1) {
+                algoArg4K.inAry   = (src + srcCnt);
+                algoArg4K.blkSize = chosenAlgos4K.workingBlkSize;
+                btcmpctr_runAlgo4K(chosenAlgos4K.algoIdx,&algoArg4K);
+                result = &algoArg4K;
+                blkBitln = *result->bitln;
+                chosenAlgo = chosenAlgos4K.algoHeader;
+             } else {
+                chosenAlgo = BITC_ALG_NONE;
+            }
+            // Insert Header
+            #ifdef __BTCMPCTR__EN_DBG__
+            mDebugStr.str(""); mDebugStr << "Inserting Header, chosen Algo in 4K is "<< std::to_string(chosenAlgo);
+            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+            #endif
+            btcmpctr_insrt_hdr(writer, chosenAlgo, blkBitln, 0,chosenAlgos4K.workingBlkSize,MIXED,0);
+            // 4K blocks are never dual encoded, the field is only there
+            // to match the 64B blocks.
+            if(DUAL && args.streamVersion && (chosenAlgo != BITC_ALG_NONE)) {
+                writer.insert(0,2);
+            }
+            // Insert Post Header bytes
+            // Insert the symbols in case of BINEXPPROC.
+            if ( (chosenAlgo == BINEXPPROC) ) {
+               // Insert 6 bits of numSyms
+               int numSymsToInsrt = (*result->numSyms == 64) && (NUMSYMSBL4K == 6) ? 0 : *result->numSyms;
+               writer.insert(numSymsToInsrt,NUMSYMSBL4K);
+               // Insert the number of symbols.
+               for(int i = 0; i < *result->numSyms; i++) {
+                   #ifdef __BTCMPCTR__EN_DBG__
+                   mDebugStr.str(""); mDebugStr << "Inserting Binned Header "<< std::to_string(i) << ", "<< std::to_string(result->minimum[i]);
+                   BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+                   #endif
+                   writer.insert(result->minimum[i],8);
+               }
+            }
+            if ( (chosenAlgo == BTEXPPROC) ) {
+                // Insert 8bits of max freq symbol.
+                writer.insert(result->minimum[0],8);
+                // insert 14bits of byte length (14 to keep an even number of header bits)
+                writer.insert(*result->numBytes,8);
+                writer.insert((*result->numBytes>>8),6);
+                // Insert 4096 bits of bitmap
+                writer.insertBitmap(result->bitmap,chosenAlgos4K.workingBlkSize);
+            }
 
-                // Work on the 64B block size.
-                cmprsdSize = 0;
-                smCntr = 0;
-                numSmBlks = 0;
-                while(smCntr < bigBlkSize) {
+            // Insert data.
+            #ifdef __BTCMPCTR__EN_DBG__
+            mDebugStr.str(""); mDebugStr << "Inserting Data";
+            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+            #endif
+            int dataSize = (chosenAlgo == BTEXPPROC) ? *result->numBytes : chosenAlgos4K.workingBlkSize;
+            const unsigned char* data = result ? result->residual : (src + srcCnt);
+            #ifdef __BTCMPCTR__EN_DBG__
+            for(int i = 0; i< dataSize; i++) {
+                mDebugStr.str(""); mDebugStr << "Inserting Data cnt ="<< std::to_string(i)<<" Data = "<< std::to_string(data[i])<< ", Src Data = "<< std::hex << std::to_string(*(src + srcCnt + i));
+                BTC_REPORT_INFO(mVerbosityLevel,6,mDebugStr.str().c_str());
+            }
+            #endif
+            writer.insertRun(data,dataSize,blkBitln);
 
-                    if( (smCntr + BLKSIZE) > bigBlkSize) {
-                        workingBlkSize = (bigBlkSize - smCntr);
-                    } else {
-                        workingBlkSize = BLKSIZE;
-                    }
-                    algoArg.inAry = (src + srcCnt + smCntr);
-                    algoArg.blkSize = workingBlkSize;
-                    // Call the Algo Choice.
-                    #ifdef __BTCMPCTR__EN_DBG__
-                    mDebugStr.str(""); mDebugStr << "Trying to find best algo for this blockCnt = "<< std::to_string(blkCnt);
-                    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                    #endif
-                    chosenAlgos[numSmBlks].workingBlkSize = workingBlkSize;
-                    if (workingBlkSize == BLKSIZE) {
-                        chosenAlgos[numSmBlks] = btcmpctr_ChooseAlgo64B(&algoArg,args.mixedBlkSize,args.dual_encode_en);
-                        #ifdef __BTCMPCTR__EN_DBG__
-                        mDebugStr.str(""); mDebugStr << " blkCnt = "<< std::to_string(blkCnt);
-                        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                        #endif
-                    }
-                    cmprsdSize += chosenAlgos[numSmBlks].cmprsdSize;
-                    numSmBlks++;
-                    smCntr += workingBlkSize;
-                    #ifdef __BTCMPCTR__EN_DBG__
-                    mDebugStr.str(""); mDebugStr << "bigBlkSize = "<< std::to_string(bigBlkSize)<< ", smCntr = "<< std::to_string(smCntr) << ", numSmBlks = "<< std::to_string(numSmBlks);
-                    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                    #endif
+        } else {
+            //---------------------------------------------------------------------------------
+            // Chosen 64B Blocks
+            //---------------------------------------------------------------------------------
+            // The output of the chosen algo of each block is already in the scratch area.
+            smCntr = 0;
+            for(int smBlk = 0; smBlk < numSmBlks ; smBlk++) {
+                #ifdef __BTCMPCTR__EN_DBG__
+                mDebugStr.str(""); mDebugStr << "Emitting chosen algo for small block count = "<< std::to_string(smBlk) <<"with blockSize = "<< std::to_string(chosenAlgos[smBlk].workingBlkSize);
+                BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+                #endif
+                if (chosenAlgos[smBlk].workingBlkSize < BLKSIZE) {
+                    // Force an Algo for the last block.
+                    chosenAlgos[smBlk].none = 1;
+                    chosenAlgos[smBlk].dual_encode = 0;
                 }
-                // IF    Compressed size of 4K block < totoal comporessed size of 64B blocks, and if this is not the last <4K block. and if mixed Block size is enabled.
-                if( (((chosenAlgos4K.cmprsdSize <= cmprsdSize) && (bigBlkSize == BIGBLKSIZE)) || args.bypass_en) && args.mixedBlkSize) {
-                    //---------------------------------------------------------------------------------
-                    // Chosen 4K Blocks
-                    //---------------------------------------------------------------------------------
+                const btcmpctr_algo_args_t* result = &algoArgs[smBlk];
+                unsigned char blkBitln = 8;
+                if(chosenAlgos[smBlk].none != 1) {
+                    blkBitln = *result->bitln;
+                    chosenAlgo = chosenAlgos[smBlk].algoHeader;
+                 } else {
+                    chosenAlgo = BITC_ALG_NONE;
+                }
+                // Insert Header
+                #ifdef __BTCMPCTR__EN_DBG__
+                mDebugStr.str(""); mDebugStr << "Inserting Header";
+                BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+                #endif
+                btcmpctr_insrt_hdr(writer, chosenAlgo, blkBitln, 0,chosenAlgos[smBlk].workingBlkSize,MIXED,0);
+                // Insert Post Header bytes
+                if(chosenAlgo != BITC_ALG_NONE) {
                     #ifdef __BTCMPCTR__EN_DBG__
-                    mDebugStr.str(""); mDebugStr << "Running chosen algo";
+                    mDebugStr.str(""); mDebugStr << "Inserting Header";
                     BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
                     #endif
-                    if ( (chosenAlgos4K.workingBlkSize < BIGBLKSIZE) || args.bypass_en) {
-                        // Force an Algo for the last block.
-                        chosenAlgos4K.none = 1;
-                    }
-                    if(chosenAlgos4K.none != 1) {
-                        algoArg.inAry = (src + srcCnt);
-                        algoArg.blkSize = chosenAlgos4K.workingBlkSize;
-                        (this->*chosenAlgos4K.chosenAlgo)(&algoArg);
-                        chosenAlgo = chosenAlgos4K.algoHeader;
-                     } else {
-                        bitln = 8;
-                        for(int i = 0; i < chosenAlgos4K.workingBlkSize; i++) {
-                            residual[i] = *(src + srcCnt + i);
+                    if(chosenAlgos[smBlk].dual_encode) {
+                        writer.insert(1,2);
+                        #ifdef DL_INC_BL
+                        // Insert the bit length
+                        //calculae the bitlength
+                        uint16_t cpBitLen = 0;
+                        for(int i = 0; i < chosenAlgos[smBlk].workingBlkSize; i++) {
+                            cpBitLen = result->bitmap[i] ? cpBitLen+8 : cpBitLen+blkBitln;
                         }
-                        chosenAlgo = BITC_ALG_NONE;
+                        // Insert 10 bits.
+                        writer.insert(cpBitLen,10);
+                        #endif
+                    } else {
+                        writer.insert(0,2);
                     }
-                    // Insert Header
+                }
+                if( (chosenAlgo == ADDPROC) || (chosenAlgo == SIGNSHFTADDPROC) ) {
+                    // Insert one more byte.
                     #ifdef __BTCMPCTR__EN_DBG__
-                    mDebugStr.str(""); mDebugStr << "Inserting Header, chosen Algo in 4K is "<< std::to_string(chosenAlgo);
+                    mDebugStr.str(""); mDebugStr << "Inserting Header plus 1 more byte";
                     BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
                     #endif
-                    state = btcmpctr_insrt_hdr(chosenAlgo, bitln, &dstCnt, dst, state, &accum,0,chosenAlgos4K.workingBlkSize,args.mixedBlkSize,0);
-                    // Insert Post Header bytes
-                    // Insert the symbols in case of BINEXPPROC.
-                    if ( (chosenAlgo == BINEXPPROC) ) {
-                       // Insert 6 bits of numSyms
-                       int numSymsToInsrt = (numSyms == 64) && (NUMSYMSBL4K == 6) ? 0 : numSyms;
-                       state = btcmpctr_insrt_byte(numSymsToInsrt,NUMSYMSBL4K,&dstCnt,dst,state,&accum,0);
-                       // Insert the number of symbols.
-                       for(int i = 0; i < numSyms; i++) {
-                           #ifdef __BTCMPCTR__EN_DBG__
-                           mDebugStr.str(""); mDebugStr << "Inserting Binned Header "<< std::to_string(i) << ", "<< std::to_string(minimum[i]);
-                           BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                           #endif
-                           state = btcmpctr_insrt_byte(minimum[i],8,&dstCnt,dst,state,&accum,0);
-                       }
-                    }
-                    if ( (chosenAlgo == BTEXPPROC) ) {
-                        // Insert 8bits of max freq symbol.
-                        state = btcmpctr_insrt_byte(minimum[0],8,&dstCnt,dst,state,&accum,0);
-                        // insert 14bits of byte length (14 to keep an even number of header bits)
-                        state = btcmpctr_insrt_byte(numBytes,8,&dstCnt,dst,state,&accum,0);
-                        state = btcmpctr_insrt_byte((numBytes>>8),6,&dstCnt,dst,state,&accum,0);
-                        // Insert 4096 bits of bitmap
-                        for(int i = 0; i < chosenAlgos4K.workingBlkSize; i++) {
-                           state = btcmpctr_insrt_byte(bitmap[i],1,&dstCnt,dst,state,&accum,0);
-                        }
+                    writer.insert(result->minimum[0],8);
+                }
+                // Insert the symbols in case of BINEXPPROC.
+                if ( (chosenAlgo == BINEXPPROC) ) {
+                   // Insert 5 bits of numSyms
+                   int numSymsToInsrt = (*result->numSyms == 16) && (NUMSYMSBL == 4) ? 0 : *result->numSyms;
+                   writer.insert(numSymsToInsrt,NUMSYMSBL);
+                   // Insert the number of symbols.
+                   for(int i = 0; i < *result->numSyms; i++) {
+                       #ifdef __BTCMPCTR__EN_DBG__
+                       mDebugStr.str(""); mDebugStr << "Inserting Binned Header "<< std::to_string(i)<<", "<< std::to_string(result->minimum[i]);
+                       BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+                       #endif
+                       writer.insert(result->minimum[i],8);
+                   }
+                }
+                if ( (chosenAlgo == BTEXPPROC) ) {
+                    // Insert 8bits of max freq symbol.
+                    writer.insert(result->minimum[0],8);
+                    // insert 8bits of byte length (8 to keep an even number of header bits)
+                    writer.insert(*result->numBytes,8);
+                    // Insert 64 bits of bitmap
+                    writer.insertBitmap(result->bitmap,chosenAlgos[smBlk].workingBlkSize);
+                }
+                // Insert the Bitmap for dual encode
+                if(DUAL) {
+                    if(chosenAlgos[smBlk].dual_encode) {
+                        writer.insertBitmap(result->bitmap,chosenAlgos[smBlk].workingBlkSize);
                     }
+                }
 
-                    // Insert data.
-                    #ifdef __BTCMPCTR__EN_DBG__
-                    mDebugStr.str(""); mDebugStr << "Inserting Data";
-                    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                    #endif
-                    int dataSize = (chosenAlgo == BTEXPPROC) ? numBytes : chosenAlgos4K.workingBlkSize;
+                // Insert data.
+                #ifdef __BTCMPCTR__EN_DBG__
+                mDebugStr.str(""); mDebugStr << "Inserting Data";
+                BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+                #endif
+                int dataSize = (chosenAlgo == BTEXPPROC) ? *result->numBytes : chosenAlgos[smBlk].workingBlkSize;
+                const unsigned char* data = (chosenAlgo != BITC_ALG_NONE) ? result->residual : (src + srcCnt + smCntr);
+                #ifdef __BTCMPCTR__EN_DBG__
+                for(int i = 0; i< dataSize; i++) {
+                    mDebugStr.str(""); mDebugStr << "Inserting Data cnt ="<< std::to_string(i) <<" Data = "<< std::to_string(data[i])<<", Src Data = "<< std::hex << std::to_string(*(src + srcCnt + smCntr + i));
+                    BTC_REPORT_INFO(mVerbosityLevel,6,mDebugStr.str().c_str());
+                }
+                #endif
+                if( (DUAL) && (chosenAlgos[smBlk].dual_encode) ) {
                     for(int i = 0; i< dataSize; i++) {
-                        #ifdef __BTCMPCTR__EN_DBG__
-                        mDebugStr.str(""); mDebugStr << "Inserting Data cnt ="<< std::to_string(i)<<" Data = "<< std::to_string(residual[i])<< ", Src Data = "<< std::hex << std::to_string(*(src + srcCnt + i));
-                        BTC_REPORT_INFO(mVerbosityLevel,6,mDebugStr.str().c_str());
-                        #endif
-                        state = btcmpctr_insrt_byte(residual[i],bitln,&dstCnt,dst,state,&accum,0);
+                        writer.insert(data[i],result->bitmap[i] ? 8 : blkBitln);
                     }
-
                 } else {
-                    //---------------------------------------------------------------------------------
-                    // Chosen 64B Blocks
-                    //---------------------------------------------------------------------------------
-                    // ChosenAlgo must be re-run with to correctly generate the compressed
-                    smCntr = 0;
-                    for(int smBlk = 0; smBlk < numSmBlks ; smBlk++) {
-                        #ifdef __BTCMPCTR__EN_DBG__
-                        mDebugStr.str(""); mDebugStr << "Running chosen algo for small block count = "<< std::to_string(smBlk) <<"with blockSize = "<< std::to_string(chosenAlgos[smBlk].workingBlkSize);
-                        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                        #endif
-                        if ( (chosenAlgos[smBlk].workingBlkSize < BLKSIZE) || args.bypass_en) {
-                            // Force an Algo for the last block.
-                            chosenAlgos[smBlk].none = 1;
-                            chosenAlgos[smBlk].dual_encode = 0;
-                        }
-                        if(chosenAlgos[smBlk].none != 1) {
-                            algoArg.inAry = (src + srcCnt + smCntr);
-                            algoArg.blkSize = chosenAlgos[smBlk].workingBlkSize;
-                            (this->*chosenAlgos[smBlk].chosenAlgo)(&algoArg);
-                            chosenAlgo = chosenAlgos[smBlk].algoHeader;
-                            if(chosenAlgos[smBlk].dual_encode) {
-                                // Re-run dualEncode calculate length
-                                btcmpctr_calc_dual_bitln((unsigned char*)&residual,&bitln,chosenAlgos[smBlk].workingBlkSize,(unsigned char*)bitmap,&dualCpSize);
-                            }
-                         } else {
-                            bitln = 8;
-                            for(int i = 0; i < chosenAlgos[smBlk].workingBlkSize; i++) {
-                                residual[i] = *(src + srcCnt + smCntr + i);
-                            }
-                            chosenAlgo = BITC_ALG_NONE;
-                        }
-                        // Insert Header
-                        #ifdef __BTCMPCTR__EN_DBG__
-                        mDebugStr.str(""); mDebugStr << "Inserting Header";
-                        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                        #endif
-                        state = btcmpctr_insrt_hdr(chosenAlgo, bitln, &dstCnt, dst, state, &accum,0,chosenAlgos[smBlk].workingBlkSize,args.mixedBlkSize,0);
-                        // Insert Post Header bytes
-                        if(chosenAlgo != BITC_ALG_NONE) {
-                            #ifdef __BTCMPCTR__EN_DBG__
-                            mDebugStr.str(""); mDebugStr << "Inserting Header";
-                            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                            #endif
-                            if(chosenAlgos[smBlk].dual_encode) {
-                                state = btcmpctr_insrt_byte(1,2,&dstCnt,dst,state,&accum,0);
-                                #ifdef DL_INC_BL
-                                // Insert the bit length
-                                //calculae the bitlength
-                                uint16_t cpBitLen = 0;
-                                for(int i = 0; i < chosenAlgos[smBlk].workingBlkSize; i++) {
-                                    cpBitLen = bitmap[i] ? cpBitLen+8 : cpBitLen+bitln;
-                                }
-                                // Insert 10 bits.
-                                state = btcmpctr_insrt_byte(cpBitLen,8,&dstCnt,dst,state,&accum,0);
-                                cpBitLen >>= 8;
-                                state = btcmpctr_insrt_byte(cpBitLen,2,&dstCnt,dst,state,&accum,0);
-                                #endif
-                            } else {
-                                state = btcmpctr_insrt_byte(0,2,&dstCnt,dst,state,&accum,0);
-                            }
-                        }
-                        if( (chosenAlgo == ADDPROC) || (chosenAlgo == SIGNSHFTADDPROC) ) {
-                            // Insert one more byte.
-                            #ifdef __BTCMPCTR__EN_DBG__
-                            mDebugStr.str(""); mDebugStr << "Inserting Header plus 1 more byte";
-                            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                            #endif
-                            state = btcmpctr_insrt_byte(minimum[0],8,&dstCnt,dst,state,&accum,0);
-                        }
-                        // Insert the symbols in case of BINEXPPROC.
-                        if ( (chosenAlgo == BINEXPPROC) ) {
-                           // Insert 5 bits of numSyms
-                           int numSymsToInsrt = (numSyms == 16) && (NUMSYMSBL == 4) ? 0 : numSyms;
-                           state = btcmpctr_insrt_byte(numSymsToInsrt,NUMSYMSBL,&dstCnt,dst,state,&accum,0);
-                           // Insert the number of symbols.
-                           for(int i = 0; i < numSyms; i++) {
-                               #ifdef __BTCMPCTR__EN_DBG__
-                               mDebugStr.str(""); mDebugStr << "Inserting Binned Header "<< std::to_string(i)<<", "<< std::to_string(minimum[i]);
-                               BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                               #endif
-                               state = btcmpctr_insrt_byte(minimum[i],8,&dstCnt,dst,state,&accum,0);
-                           }
-                        }
-                        if ( (chosenAlgo == BTEXPPROC) ) {
-                            // Insert 8bits of max freq symbol.
-                            state = btcmpctr_insrt_byte(minimum[0],8,&dstCnt,dst,state,&accum,0);
-                            // insert 8bits of byte length (8 to keep an even number of header bits)
-                            state = btcmpctr_insrt_byte(numBytes,8,&dstCnt,dst,state,&accum,0);
-                            // Insert 64 bits of bitmap
-                            for(int i = 0; i < chosenAlgos[smBlk].workingBlkSize; i++) {
-                               state = btcmpctr_insrt_byte(bitmap[i],1,&dstCnt,dst,state,&accum,0);
-                            }
-                        }
-                        // Insert the Bitmap for dual encode
-                        if(args.dual_encode_en) {
-                            if(chosenAlgos[smBlk].dual_encode) {
-                                for(int i = 0; i < chosenAlgos[smBlk].workingBlkSize; i++) {
-                                   state = btcmpctr_insrt_byte(bitmap[i],1,&dstCnt,dst,state,&accum,0);
-                                }
-                            }
-                        }
-
-                        // Insert data.
-                        #ifdef __BTCMPCTR__EN_DBG__
-                        mDebugStr.str(""); mDebugStr << "Inserting Data";
-                        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                        #endif
-                        int dataSize = (chosenAlgo == BTEXPPROC) ? numBytes : chosenAlgos[smBlk].workingBlkSize;
-                        for(int i = 0; i< dataSize; i++) {
-                            #ifdef __BTCMPCTR__EN_DBG__
-                            mDebugStr.str(""); mDebugStr << "Inserting Data cnt ="<< std::to_string(i) <<" Data = "<< std::to_string(residual[i])<<", Src Data = "<< std::hex << std::to_string(*(src + srcCnt + smCntr + i));
-                            BTC_REPORT_INFO(mVerbosityLevel,6,mDebugStr.str().c_str());
-                            #endif
-                            if( (args.dual_encode_en) && (chosenAlgos[smBlk].dual_encode) && bitmap[i] ) {
-                                state = btcmpctr_insrt_byte(residual[i],8,&dstCnt,dst,state,&accum,0);
-                            } else {
-                                state = btcmpctr_insrt_byte(residual[i],bitln,&dstCnt,dst,state,&accum,0);
-                            }
-                        }
-                        //
-                        #ifdef __BTCMPCTR__EN_DBG__
-                        mDebugStr.str(""); mDebugStr << "Destination length is "<< std::to_string(dstCnt);
-                        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                        #endif
-                        smCntr += chosenAlgos[smBlk].workingBlkSize;
-                    }
+                    writer.insertRun(data,dataSize,blkBitln);
                 }
-                srcCnt += bigBlkSize;
-                blkCnt++;
-            }
-            // Insert end of stream bits.
-            #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Inserting End of Stream";
-            BTC_REPORT_INFO(mVerbosityLevel,6,mDebugStr.str().c_str());
-            #endif
-            state = btcmpctr_insrt_hdr(0,0,&dstCnt,dst,state,&accum,1,0,0,args.align);
-            // Check if state is non-zero, if so,  need to increment dstLen.
-            if(state != 0) {
+                //
                 #ifdef __BTCMPCTR__EN_DBG__
-                mDebugStr.str(""); mDebugStr << "ERROR: state != 0 at the end of compression";
-                BTC_REPORT_INFO(mVerbosityLevel,0,mDebugStr.str().c_str());
+                mDebugStr.str(""); mDebugStr << "Destination length is "<< std::to_string(writer.length());
+                BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
                 #endif
+                smCntr += chosenAlgos[smBlk].workingBlkSize;
             }
-            // All Done!!
-            dstLen = dstCnt;
-            return 1;
+        }
+        srcCnt += bigBlkSize;
+        blkCnt++;
+    }
+    // Insert end of stream bits.
+    #ifdef __BTCMPCTR__EN_DBG__
+    mDebugStr.str(""); mDebugStr << "Inserting End of Stream";
+    BTC_REPORT_INFO(mVerbosityLevel,6,mDebugStr.str().c_str());
+    #endif
+    btcmpctr_insrt_hdr(writer,0,0,1,0,0,args.align);
+    // Check if state is non-zero, if so,  need to increment dstLen.
+    if(writer.state() != 0) {
+        #ifdef __BTCMPCTR__EN_DBG__
+        mDebugStr.str(""); mDebugStr << "ERROR: state != 0 at the end of compression";
+        BTC_REPORT_INFO(mVerbosityLevel,0,mDebugStr.str().c_str());
+        #endif
+    }
+    // All Done!!
+    dstLen = writer.length();
+    return 1;
+}
+
+int BitCompactor::CompressWrap(const unsigned char*                 src,
+                               unsigned int                         srcLen,
+                               unsigned char*                       dst,
+                               unsigned int&                        dstLen, // dstLen holds the size of the output buffer.
+                               const btcmpctr_compress_wrap_args_t& args
+                           )
+{
+    mVerbosityLevel = args.verbosity;
+    mStreamVersion  = args.streamVersion;
+    if(src && dst)
+    {
+        // Check if output buffer is big enough for compressed data worst case
+        unsigned int boundSize = this->GetCompressedSizeBound(srcLen);
+        if(boundSize <= dstLen)
+        {
+            btcmpctr_initAlgosAry(args);
+            // The final destination size will be returned in dstLen.
+            return (this->*btcmpctr_getCompressEngine(args))(src, srcLen, dst, dstLen, args);
         }
         else {
             BTC_REPORT_ERROR("CompressWrap: ERROR! Output buffer not big enough for worst case");
@@ -1566,134 +2807,375 @@ unsigned int BitCompactor::DecompressArray(const unsigned char* const
     }
 }
 
-int BitCompactor::DecompressWrap(const unsigned char*                   src,
-                                 unsigned int                           srcLen,
-                                 unsigned char*                         dst,
-                                 unsigned int&                          dstLen,
-                                 const btcmpctr_compress_wrap_args_t&   args
-                            )
+// Decompression engine, specialized on the configuration flags that change
+// the stream layout. The buffers are checked by DecompressWrap.
+template <int MIXED, int DUAL>
+int BitCompactor::btcmpctr_DecompressEngine(const unsigned char*                 src,
+                                            unsigned int                         srcLen,
+                                            unsigned char*                       dst,
+                                            unsigned int&                        dstLen
+                                           )
 {
-    if(src && dst)
-    {
-        unsigned char state = 0;
-        unsigned char cmp, eofr,algo,bitln, numSyms;
-        int blkSize;
-        unsigned char bytes_to_add[MAXSYMS4K];
-        unsigned char bitmap[BIGBLKSIZE];
-        unsigned char bitmapBytes[BIGBLKSIZE];
-        unsigned int numBytes = 0;
-        unsigned int blkCnt = 0;
-        unsigned int srcLenTrk = 0;
-        mVerbosityLevel = args.verbosity;
-        int mixedBlkSize = args.mixedBlkSize;
-        int dual_encode_en = args.dual_encode_en;
-        unsigned char dual_encode;
-        unsigned int dstCnt = 0;
-
-        while ( ( srcLenTrk < srcLen ) ) {
-            // Extract Header
-            #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Extracting Header for blockCnt = "<< std::to_string(blkCnt);
-            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-            #endif
-            state = btcmpctr_xtrct_hdr(src,&srcLenTrk,state,&cmp,&eofr,&algo,&bitln,&blkSize,(unsigned char*)bytes_to_add,&numSyms,&numBytes,(unsigned char *)bitmap,mixedBlkSize,dual_encode_en,&dual_encode);
-            #ifdef __BTCMPCTR__EN_DBG__
-            if ( srcLenTrk > ( (srcLen) - 1 ) && ( (srcLen) > 0 ) )
-            {
-                // no more compressed source data to process; srcLenTrk has reached the end of the array
-                mDebugStr.str(""); mDebugStr << "src = 0x--, srcLen = "<< std::to_string(srcLen) <<", srcLenTrk = "<< std::to_string(srcLenTrk) <<", EOFR = "<< std::to_string(eofr) <<", Compressed = "<< std::to_string(cmp) <<", Algo = "<< std::to_string(algo) <<", Bit Length = "<< std::to_string(bitln) <<", Block Size = "<< std::to_string(blkSize) << "[reached end of source data]";
+    btcmpctr_decode_stream_t stream;
+    btcmpctr_openStream(&stream, src, srcLen, dst, dstLen);
+
+    while ( ( stream.reader.byteIndex() < srcLen ) ) {
+        int status = btcmpctr_DecodeBlock<MIXED,DUAL,0>(&stream);
+        if (status != BTC27_DECODE_OK) {
+            return status;
+        }
+    }
+    // All Done!!
+    dstLen = stream.dstCnt;
+    return BTC27_DECODE_OK;
+}
+
+// Decompression engine for a buffer followed by BTC27_DECODE_PADDING bytes.
+// A block starting MAXBLKBYTES or more before the end of the buffer ends
+// before it, so its unchecked loads read at most the padding. The last
+// blocks are decoded with the checked reader. The buffers are checked by
+// DecompressPaddedWrap.
+template <int MIXED, int DUAL>
+int BitCompactor::btcmpctr_DecompressPaddedEngine(const unsigned char* src,
+                                                  unsigned int         srcLen,
+                                                  unsigned char*       dst,
+                                                  unsigned int&        dstLen
+                                                 )
+{
+    btcmpctr_decode_stream_s<1> fast;
+    btcmpctr_openStream(&fast, src, srcLen, dst, dstLen);
+    const unsigned int fastLen = (srcLen > MAXBLKBYTES) ? (srcLen - MAXBLKBYTES) : 0;
+
+    while ( ( fast.reader.byteIndex() < fastLen ) ) {
+        int status = btcmpctr_DecodeBlock<MIXED,DUAL,1>(&fast);
+        if (status != BTC27_DECODE_OK) {
+            dstLen = fast.dstCnt;
+            return status;
+        }
+    }
+
+    btcmpctr_decode_stream_t stream;
+    btcmpctr_openStream(&stream, src, srcLen, dst, dstLen);
+    stream.reader.skip(fast.reader.position());
+    stream.dstCnt = fast.dstCnt;
+    stream.blkCnt = fast.blkCnt;
+    // Entries of the lookup table past numSyms are left from earlier blocks.
+    memcpy(stream.bytes_to_add, fast.bytes_to_add, sizeof(stream.bytes_to_add));
+
+    while ( ( stream.reader.byteIndex() < srcLen ) ) {
+        int status = btcmpctr_DecodeBlock<MIXED,DUAL,0>(&stream);
+        if (status != BTC27_DECODE_OK) {
+            dstLen = stream.dstCnt;
+            return status;
+        }
+    }
+    dstLen = stream.dstCnt;
+    return BTC27_DECODE_OK;
+}
+
+// Fused decompression and dequantization engine. The blocks are decompressed
+// to a BIGBLKSIZE scratch, still in cache when they are dequantized to dst,
+// a run of elements sharing a channel at a time, or the whole block with
+// per element scales if the runs are short (see DEQUANT_MINRUN). The
+// buffers and the dequantization args are checked by btcmpctr_DecompressDequant.
+template <int MIXED, int DUAL>
+int BitCompactor::btcmpctr_DecompressDequantEngine(const unsigned char*           src,
+                                                   unsigned int                   srcLen,
+                                                   void*                          dst,
+                                                   int                            outType,
+                                                   unsigned int&                  dstLen,
+                                                   const btcmpctr_dequant_args_t& dequant
+                                                  )
+{
+    unsigned char blk[BIGBLKSIZE];
+    btcmpctr_decode_stream_t stream;
+    btcmpctr_openStream(&stream, src, srcLen, nullptr, dstLen);
+    stream.blkBuf = blk;
+    // Channel of the next element and its index in the channel run
+    unsigned int channel = 0;
+    unsigned int chanPos = 0;
+
+    // Per element scales and zero points. If the channel period is short, the
+    // period followed by BIGBLKSIZE more elements, a block starts at phase.
+    const bool perElem = (dequant.channelStride < DEQUANT_MINRUN);
+    const uint64_t period = (uint64_t)dequant.numChannels * dequant.channelStride;
+    const bool periodic = perElem && (period <= DEQUANT_MAXPERIOD);
+    std::vector<float> elemScale;
+    std::vector<float> elemZeroPoint;
+    unsigned int phase = 0;
+    if (perElem) {
+        unsigned int elemLen = periodic ? (unsigned int)period + BIGBLKSIZE : BIGBLKSIZE;
+        elemScale.resize(elemLen);
+        elemZeroPoint.resize(elemLen);
+        if (periodic) {
+            btcmpctr_dequantExpand(dequant, channel, chanPos, elemLen, elemScale.data(), elemZeroPoint.data());
+        }
+    }
+
+    while ( ( stream.reader.byteIndex() < srcLen ) ) {
+        unsigned int dstCnt = stream.dstCnt;
+        int status = btcmpctr_DecodeBlock<MIXED,DUAL,0>(&stream);
+        if (status != BTC27_DECODE_OK) {
+            return status;
+        }
+        if (perElem) {
+            unsigned int cnt = stream.dstCnt - dstCnt;
+            const float* scale     = elemScale.data() + phase;
+            const float* zeroPoint = elemZeroPoint.data() + phase;
+            if (periodic) {
+                phase = (unsigned int)((phase + cnt) % period);
+            } else {
+                btcmpctr_dequantExpand(dequant, channel, chanPos, cnt, elemScale.data(), elemZeroPoint.data());
+            }
+            if (outType == DEQUANT_F16) {
+                btcmpctr_dequant(blk, cnt, dequant.isSigned, scale, zeroPoint, (uint16_t*)dst + dstCnt);
+            } else {
+                btcmpctr_dequant(blk, cnt, dequant.isSigned, scale, zeroPoint, (float*)dst + dstCnt);
             }
-            else
-            {
-                // still more compressed source data left to process
-                mDebugStr.str(""); mDebugStr << "src = 0x" << std::hex << std::setfill('0') << std::setw(2) << std::to_string(src[srcLenTrk]) <<", srcLen = "<< std::dec << std::to_string(srcLen) <<", srcLenTrk = "<< std::to_string(srcLenTrk) <<", EOFR = "<< std::to_string(eofr) <<", Compressed = "<< std::to_string(cmp) <<", Algo = "<< std::to_string(algo) <<", Bit Length = "<< std::to_string(bitln) <<", Block Size = "<< std::to_string(blkSize);
+            continue;
+        }
+        for(unsigned int i = 0, cnt = stream.dstCnt - dstCnt; i < cnt; ) {
+            unsigned int run = std::min(cnt - i, dequant.channelStride - chanPos);
+            float scale = dequant.scale[channel];
+            float zeroPoint = dequant.zeroPoint ? dequant.zeroPoint[channel] : 0.0f;
+            if (outType == DEQUANT_F16) {
+                btcmpctr_dequant(blk + i, run, dequant.isSigned, scale, zeroPoint, (uint16_t*)dst + dstCnt + i);
+            } else {
+                btcmpctr_dequant(blk + i, run, dequant.isSigned, scale, zeroPoint, (float*)dst + dstCnt + i);
             }
-            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-            #endif
+            i       += run;
+            chanPos += run;
+            if (chanPos == dequant.channelStride) {
+                chanPos = 0;
+                channel = (channel + 1 == dequant.numChannels) ? 0 : (channel + 1);
+            }
+        }
+    }
+    dstLen = stream.dstCnt;
+    return BTC27_DECODE_OK;
+}
+
+template <int PADDED>
+void BitCompactor::btcmpctr_openStream(btcmpctr_decode_stream_s<PADDED>* stream,
+                                       const unsigned char*              src,
+                                       unsigned int                      srcLen,
+                                       unsigned char*                    dst,
+                                       unsigned int                      dstLen
+                                      )
+{
+    static_assert((sizeof(stream->bytes_to_add) == MAXSYMS4K) && (sizeof(stream->bitmap) == BIGBLKSIZE) &&
+                  (sizeof(stream->bitmapBytes) == BIGBLKSIZE), "Decoder scratch size mismatch");
+    stream->reader.reset(src, srcLen);
+    stream->src    = src;
+    stream->srcLen = srcLen;
+    stream->dst    = dst;
+    stream->dstLen = dstLen;
+    stream->dstCnt = 0;
+    stream->blkCnt = 0;
+    stream->blkBuf = nullptr;
+    memset(stream->bytes_to_add, 0, sizeof(stream->bytes_to_add));
+}
+
+template <int MIXED, int DUAL, int PADDED>
+int BitCompactor::btcmpctr_DecodeBlock(btcmpctr_decode_stream_s<PADDED>* stream)
+{
+    unsigned char cmp, eofr,algo,bitln, numSyms;
+    int blkSize;
+    unsigned int numBytes = 0;
+    unsigned char dual_encode;
+    BitReaderT<PADDED>& reader = stream->reader;
+    unsigned char* dstBlk = stream->blkBuf ? stream->blkBuf : (stream->dst + stream->dstCnt);
+    unsigned char* bytes_to_add = stream->bytes_to_add;
+    unsigned char* bitmap = stream->bitmap;
+    unsigned char* bitmapBytes = stream->bitmapBytes;
+
+    // Extract Header
+    #ifdef __BTCMPCTR__EN_DBG__
+    mDebugStr.str(""); mDebugStr << "Extracting Header for blockCnt = "<< std::to_string(stream->blkCnt);
+    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+    #endif
+    btcmpctr_xtrct_hdr<MIXED,DUAL,PADDED>(reader,&cmp,&eofr,&algo,&bitln,&blkSize,bytes_to_add,&numSyms,&numBytes,bitmap,&dual_encode);
+    #ifdef __BTCMPCTR__EN_DBG__
+    unsigned int srcLen = stream->srcLen;
+    unsigned int srcLenTrk = reader.byteIndex();
+    if ( srcLenTrk > ( (srcLen) - 1 ) && ( (srcLen) > 0 ) )
+    {
+        // no more compressed source data to process; srcLenTrk has reached the end of the array
+        mDebugStr.str(""); mDebugStr << "src = 0x--, srcLen = "<< std::to_string(srcLen) <<", srcLenTrk = "<< std::to_string(srcLenTrk) <<", EOFR = "<< std::to_string(eofr) <<", Compressed = "<< std::to_string(cmp) <<", Algo = "<< std::to_string(algo) <<", Bit Length = "<< std::to_string(bitln) <<", Block Size = "<< std::to_string(blkSize) << "[reached end of source data]";
+    }
+    else
+    {
+        // still more compressed source data left to process
+        mDebugStr.str(""); mDebugStr << "src = 0x" << std::hex << std::setfill('0') << std::setw(2) << std::to_string(stream->src[srcLenTrk]) <<", srcLen = "<< std::dec << std::to_string(srcLen) <<", srcLenTrk = "<< std::to_string(srcLenTrk) <<", EOFR = "<< std::to_string(eofr) <<", Compressed = "<< std::to_string(cmp) <<", Algo = "<< std::to_string(algo) <<", Bit Length = "<< std::to_string(bitln) <<", Block Size = "<< std::to_string(blkSize);
+    }
+    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+    #endif
 
-            // if we're at EOFR, OR if srcLenTrk has reached the end of
-            // the compressed source data, stop processing at this point
-            // (the 'while' loop condition should then cause us to finish)
-            if( ( srcLenTrk > ( (srcLen) - 1 ) ) || eofr )
-            {
-                continue;
+    // if we're at EOFR, which includes the zero bits completing the last
+    // byte, stop processing at this point (the caller's loop condition
+    // should then cause us to finish)
+    if( eofr )
+    {
+        return BTC27_DECODE_OK;
+    }
+    if( reader.overrun() )
+    {
+        BTC_REPORT_ERROR("DecompressWrap: Header of block " + std::to_string(stream->blkCnt) + " runs past the end of the buffer!");
+        return BTC27_DECODE_ERR_TRUNCATED;
+    }
+    // Check the bound before writing the block.
+    if( (unsigned int)blkSize > ( stream->dstLen - stream->dstCnt ) )
+    {
+        BTC_REPORT_ERROR("DeompressWrap: Max expected decompress size " + std::to_string(stream->dstLen) + " bytes exceeded!");
+        return BTC27_DECODE_ERR_DST_SIZE;
+    }
+    if( cmp && ( algo == BTEXPPROC ) && ( numBytes > (unsigned int)blkSize ) )
+    {
+        BTC_REPORT_ERROR("DecompressWrap: Block " + std::to_string(stream->blkCnt) + " has " + std::to_string(numBytes) + " bitmap bytes for " + std::to_string(blkSize) + " symbols!");
+        return BTC27_DECODE_ERR_MALFORMED;
+    }
+    //
+    if(cmp) {
+        //Compressed block. Process further based on Algo
+        #ifdef __BTCMPCTR__EN_DBG__
+        mDebugStr.str(""); mDebugStr << "Compressed Block, Extracting data";
+        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+        #endif
+        // Sign restoration, the predictor add and the BINEXP symbol
+        // lookup are applied by the extraction itself.
+        int xfrm = btcmpctr_getXfrm(algo);
+        if ( algo == BTEXPPROC ) {
+            // bitln set to 0, since we always extract 8bits for the non high freq calculations.
+            btcmpctr_xtrct_bytes(reader,0,bitmapBytes,numBytes,BTC27_XFRM_NONE,nullptr);
+        } else {
+            if(dual_encode) {
+                btcmpctr_xtrct_bytes_wbitmap(reader,bitln,dstBlk,blkSize,bitmap,xfrm,bytes_to_add);
+            } else {
+                btcmpctr_xtrct_bytes(reader,bitln,dstBlk,blkSize,xfrm,bytes_to_add);
             }
-            //
-            if(cmp) {
-                //Compressed block. Process further based on Algo
-                #ifdef __BTCMPCTR__EN_DBG__
-                mDebugStr.str(""); mDebugStr << "Compressed Block, Extracting data";
-                BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                #endif
-                if ( algo == BTEXPPROC ) {
-                    // bitln set to 0, since we always extract 8bits for the non high freq calculations.
-                    state = btcmpctr_xtrct_bytes(src,&srcLenTrk,state,0,bitmapBytes,numBytes,0);
+        }
+        if ( (algo == BTEXPPROC) ) {
+            // Expand bitmapBytes over the high freq symbol
+            int cnt = 0;
+            int i = btcmpctr_kernels().btExpand(bitmap,bitmapBytes,BIGBLKSIZE,bytes_to_add[0],blkSize,dstBlk,&cnt);
+            for(; i < blkSize; i ++) {
+                if(!bitmap[i]) {
+                    dstBlk[i] = bytes_to_add[0];
                 } else {
-                    if(dual_encode) {
-                        state = btcmpctr_xtrct_bytes_wbitmap(src,&srcLenTrk,state,bitln,(dst+dstCnt),blkSize,(unsigned char *)bitmap);
-                    } else {
-                        state = btcmpctr_xtrct_bytes(src,&srcLenTrk,state,bitln,(dst+dstCnt),blkSize,0);
-                    }
-                }
-                if ( (algo == SIGNSHFTADDPROC) || (algo == SIGNSHFTPROC) ) {
-                    // Convert to signed
-                    #ifdef __BTCMPCTR__EN_DBG__
-                    mDebugStr.str(""); mDebugStr << "Converting to Signed form";
-                    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                    #endif
-                    btcmpctr_tosigned((dst+dstCnt),(dst+dstCnt));
-                }
-                // Add any bytes.
-                if ( (algo == ADDPROC) || (algo == SIGNSHFTADDPROC) ) {
-                    // add bytes_to_add
-                    #ifdef __BTCMPCTR__EN_DBG__
-                    mDebugStr.str(""); mDebugStr << "Adding Data";
-                    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                    #endif
-                    btcmpctr_addByte((unsigned char*)bytes_to_add,0,(dst+dstCnt));
-                }
-                // Reconstruct bitmap by using lookup into bytes_to_add vector.
-                if ( (algo == BINEXPPROC) ) {
-                    for(int i = 0; i < blkSize; i++) {
-                        *(dst+dstCnt+i) = bytes_to_add[*(dst+dstCnt+i)];
-                    }
-                }
-                if ( (algo == BTEXPPROC) ) {
-                    // Extract numBytes from
-                    int cnt = 0;
-                    for(int i = 0; i < blkSize; i ++) {
-                        if(!bitmap[i]) {
-                            *(dst+dstCnt+i) = bytes_to_add[0];
-                        } else {
-                            *(dst+dstCnt+i) = bitmapBytes[cnt++];
-                        }
-                    }
-                    //assert cnt == numBytes;
+                    dstBlk[i] = bitmapBytes[cnt++];
                 }
-            } else {
-                // Uncompressed block
-                #ifdef __BTCMPCTR__EN_DBG__
-                mDebugStr.str(""); mDebugStr << "Uncompressed Data block..";
-                BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-                #endif
-                state = btcmpctr_xtrct_bytes(src,&srcLenTrk,state,bitln,(dst+dstCnt),blkSize,0);
             }
-
-            dstCnt += blkSize;
-            if (dstCnt > dstLen) {
-                BTC_REPORT_ERROR("DeompressWrap: Max expected decompress size " + std::to_string(dstLen) + " bytes exceeded!");
-                return 0;
+            if (cnt != (int)numBytes) {
+                BTC_REPORT_ERROR("DecompressWrap: Bitmap of block " + std::to_string(stream->blkCnt) + " does not match its " + std::to_string(numBytes) + " bytes!");
+                return BTC27_DECODE_ERR_MALFORMED;
             }
+        }
+    } else {
+        // Uncompressed block
+        #ifdef __BTCMPCTR__EN_DBG__
+        mDebugStr.str(""); mDebugStr << "Uncompressed Data block..";
+        BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+        #endif
+        btcmpctr_xtrct_bytes(reader,bitln,dstBlk,blkSize,BTC27_XFRM_NONE,nullptr);
+    }
 
-            #ifdef __BTCMPCTR__EN_DBG__
-            mDebugStr.str(""); mDebugStr << "Src length = "<< std::to_string(srcLenTrk);
-            BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
-            #endif
-            blkCnt++;
+    if( reader.overrun() )
+    {
+        BTC_REPORT_ERROR("DecompressWrap: Block " + std::to_string(stream->blkCnt) + " runs past the end of the buffer!");
+        return BTC27_DECODE_ERR_TRUNCATED;
+    }
+    stream->dstCnt += blkSize;
+
+    #ifdef __BTCMPCTR__EN_DBG__
+    mDebugStr.str(""); mDebugStr << "Src length = "<< std::to_string(reader.byteIndex());
+    BTC_REPORT_INFO(mVerbosityLevel,5,mDebugStr.str().c_str());
+    #endif
+    stream->blkCnt++;
+    return BTC27_DECODE_OK;
+}
+
+// Scan engine, walks the stream like btcmpctr_DecompressEngine without
+// extracting the payloads. The buffers are checked by ScanWrap.
+template <int MIXED, int DUAL>
+int BitCompactor::btcmpctr_ScanEngine(const unsigned char*   src,
+                                      unsigned int           srcLen,
+                                      unsigned int&          dstLen,
+                                      btcmpctr_block_info_t* blocks,
+                                      unsigned int&          numBlocks
+                                     )
+{
+    BitReader reader(src, srcLen);
+    unsigned int dstCnt = 0;
+    unsigned int blkCnt = 0;
+
+    while ( ( reader.byteIndex() < srcLen ) ) {
+        btcmpctr_block_info_t info;
+        unsigned long long payloadBits;
+        unsigned long long bitOffset = reader.position();
+        int eofr = btcmpctr_scan_hdr<MIXED,DUAL>(reader, &info, &payloadBits, mStreamVersion);
+        // Same end of stream and truncation conditions as btcmpctr_DecodeBlock.
+        if( eofr )
+        {
+            continue;
         }
-        // All Done!!
-        dstLen = dstCnt;
-        return 1;
+        if( reader.overrun() )
+        {
+            BTC_REPORT_ERROR("ScanWrap: Header of block " + std::to_string(blkCnt) + " at bit " + std::to_string(bitOffset) + " runs past the end of the buffer!");
+            return 0;
+        }
+        if (reader.position() + payloadBits > 8ULL*srcLen) {
+            BTC_REPORT_ERROR("ScanWrap: Block " + std::to_string(blkCnt) + " at bit " + std::to_string(bitOffset) + " runs past the end of the buffer!");
+            return 0;
+        }
+        reader.skip(payloadBits);
+        if (blkCnt < numBlocks) {
+            info.bitOffset = bitOffset;
+            blocks[blkCnt] = info;
+        }
+        dstCnt += info.blkSize;
+        blkCnt++;
+    }
+    dstLen = dstCnt;
+    numBlocks = blkCnt;
+    return 1;
+}
+
+int BitCompactor::ScanWrap(const unsigned char*                   src,
+                           unsigned int                           srcLen,
+                           unsigned int&                          dstLen,
+                           btcmpctr_block_info_t*                 blocks,
+                           unsigned int&                          numBlocks,
+                           const btcmpctr_compress_wrap_args_t&   args
+                          )
+{
+    mVerbosityLevel = args.verbosity;
+    mStreamVersion  = args.streamVersion;
+    if(src)
+    {
+        if(!blocks) {
+            numBlocks = 0;
+        }
+        return (this->*btcmpctr_getScanEngine(args))(src, srcLen, dstLen, blocks, numBlocks);
+    }
+    else
+    {
+        BTC_REPORT_ERROR("ScanWrap: ERROR! Null Pointer");
+        return 0;
+    }
+}
+
+int BitCompactor::DecompressWrap(const unsigned char*                   src,
+                                 unsigned int                           srcLen,
+                                 unsigned char*                         dst,
+                                 unsigned int&                          dstLen,
+                                 const btcmpctr_compress_wrap_args_t&   args
+                            )
+{
+    mVerbosityLevel = args.verbosity;
+    mStreamVersion  = args.streamVersion;
+    if(src && dst)
+    {
+        return ((this->*btcmpctr_getDecompressEngine(args))(src, srcLen, dst, dstLen) == BTC27_DECODE_OK) ? 1 : 0;
     }
     else
     {
@@ -1702,26 +3184,94 @@ int BitCompactor::DecompressWrap(const unsigned char*                   src,
     }
 }
 
+int BitCompactor::DecompressPaddedWrap(const unsigned char*                   src,
+                                       unsigned int                           srcLen,
+                                       unsigned char*                         dst,
+                                       unsigned int&                          dstLen,
+                                       const btcmpctr_compress_wrap_args_t&   args
+                                      )
+{
+    mVerbosityLevel = args.verbosity;
+    mStreamVersion  = args.streamVersion;
+    if(src && dst)
+    {
+        return (this->*btcmpctr_getDecompressPaddedEngine(args))(src, srcLen, dst, dstLen);
+    }
+    else
+    {
+        BTC_REPORT_ERROR("DecompressPaddedWrap: ERROR! Null Pointer");
+        dstLen = 0;
+        return BTC27_DECODE_ERR_NULL;
+    }
+}
+
+int BitCompactor::btcmpctr_DecompressDequant(const unsigned char*                 src,
+                                             unsigned int                         srcLen,
+                                             void*                                dst,
+                                             int                                  outType,
+                                             unsigned int&                        dstLen,
+                                             const btcmpctr_dequant_args_t&       dequant,
+                                             const btcmpctr_compress_wrap_args_t& args
+                                            )
+{
+    mVerbosityLevel = args.verbosity;
+    mStreamVersion  = args.streamVersion;
+    if(src && dst && dequant.scale)
+    {
+        if(dequant.numChannels && dequant.channelStride) {
+            return ((this->*btcmpctr_getDecompressDequantEngine(args))(src, srcLen, dst, outType, dstLen, dequant) == BTC27_DECODE_OK) ? 1 : 0;
+        }
+        else {
+            BTC_REPORT_ERROR("DecompressDequantWrap: ERROR! numChannels and channelStride must be non zero");
+            return 0;
+        }
+    }
+    else
+    {
+        BTC_REPORT_ERROR("DecompressDequantWrap: ERROR! Null Pointer");
+        return 0;
+    }
+}
+
+int BitCompactor::DecompressDequantWrap(const unsigned char*                   src,
+                                        unsigned int                           srcLen,
+                                        float*                                 dst,
+                                        unsigned int&                          dstLen,
+                                        const btcmpctr_dequant_args_t&         dequant,
+                                        const btcmpctr_compress_wrap_args_t&   args
+                                       )
+{
+    return btcmpctr_DecompressDequant(src, srcLen, dst, DEQUANT_F32, dstLen, dequant, args);
+}
+
+int BitCompactor::DecompressDequantWrap(const unsigned char*                   src,
+                                        unsigned int                           srcLen,
+                                        uint16_t*                              dst,
+                                        unsigned int&                          dstLen,
+                                        const btcmpctr_dequant_args_t&         dequant,
+                                        const btcmpctr_compress_wrap_args_t&   args
+                                       )
+{
+    return btcmpctr_DecompressDequant(src, srcLen, dst, DEQUANT_F16, dstLen, dequant, args);
+}
+
 unsigned int BitCompactor::GetCompressedSizeBound(unsigned int bufSize) const
 {
     return ceil(((ceil(bufSize/BLKSIZE) * 4) + 2)/8) + bufSize + 1 + 64;
 }
 
-BitCompactor::elem_type BitCompactor::getMedianNaive(elem_type arr[], unsigned int blkSize)
+// Lower median of the block from its cumulative histogram, same as sorting the block
+// as unsigned bytes and taking arr[blkSize/2 - 1] (even length) or arr[blkSize/2] (odd length).
+BitCompactor::elem_type BitCompactor::getMedianHist(const btcmpctr_blk_stats_t* stats)
 {
-    unsigned char medianValue = 0;
-
-    // Sort array in ascending order
-    std::sort(arr, arr + blkSize);
+    int rank = (stats->blkSize % 2 == 0) ? (stats->blkSize/2 - 1) : (stats->blkSize/2);
 
-    // Even length (after sorting)
-    if (blkSize % 2 == 0) {
-        medianValue = arr[blkSize/2 -1];   // As per original quick_slect(), median = lower value of two middle values
-    } else {
-        // Odd length
-        medianValue = arr[blkSize/2];
-    }
+    // Smallest v with more than rank bytes <= v, ie cumHist[v+1] > rank.
+    // cumHist is non decreasing over [umin+1..umax+1] and cumHist[umax+1] == blkSize.
+    const uint16_t* first = &stats->cumHist[stats->umin + 1];
+    const uint16_t* last  = &stats->cumHist[stats->umax + 1];
+    const uint16_t* pos   = std::upper_bound(first, last, (uint16_t)rank);
 
-    return medianValue;
+    return (elem_type)(stats->umin + (pos - first));
 }
 } // namespace btc27
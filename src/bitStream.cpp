@@ -0,0 +1,578 @@
+//
+// Copyright (C) 2023 Intel Corporation
+// SPDX-License-Identifier: Apache 2.0
+//
+
+//
+
+// Fixed-width packing kernels used by BitWriter and unpacking kernels used
+// by BitReader.
+//
+
+#include "bitStream.h"
+#include "cpuDispatch.h"
+
+#if defined(BTC27_SIMD_X86)
+#include <immintrin.h>
+#endif
+
+namespace btc27
+{
+
+//-----------------------------------------------------
+// Scalar reference kernels
+//-----------------------------------------------------
+void btcmpctr_pack64B_scalar(const unsigned char* syms,
+                             unsigned int         bitln,
+                             unsigned char*       outBuf
+                            )
+{
+    const uint64_t mask = (1ULL << bitln) - 1;
+    // Each group of 8 symbols packs into exactly bitln bytes.
+    for(int j = 0; j < 8; j++) {
+        uint64_t lane = 0;
+        for(int i = 0; i < 8; i++) {
+            lane |= (syms[8*j + i] & mask) << (i*bitln);
+        }
+        memcpy(outBuf + j*bitln, &lane, sizeof(lane));
+    }
+}
+
+uint64_t btcmpctr_packBitmap64B_scalar(const unsigned char* bitmap)
+{
+    uint64_t word = 0;
+    for(int i = 0; i < 64; i++) {
+        word |= (uint64_t)(bitmap[i] & 1) << i;
+    }
+    return word;
+}
+
+void btcmpctr_unpackBitmap64B_scalar(uint64_t word, unsigned char* bitmap)
+{
+    for(int i = 0; i < 64; i++) {
+        bitmap[i] = (unsigned char)((word >> i) & 1);
+    }
+}
+
+// Unpack kernels are generated per bitln and transform, so that every
+// shift and mask is an immediate.
+template <unsigned int BITLN, int XFRM>
+static void btcmpctr_unpack64B_scalar(const unsigned char* inBuf,
+                                      const unsigned char* xfrmArg,
+                                      unsigned char*       syms
+                                     )
+{
+    const uint64_t mask = (1ULL << BITLN) - 1;
+    for(int j = 0; j < 8; j++) {
+        uint64_t lane = 0;
+        memcpy(&lane, inBuf + j*BITLN, BITLN);
+        for(int i = 0; i < 8; i++) {
+            syms[8*j + i] = btcmpctr_xfrmSym((unsigned int)((lane >> (i*BITLN)) & mask), XFRM, xfrmArg);
+        }
+    }
+}
+
+//-----------------------------------------------------
+// SIMD kernels
+//-----------------------------------------------------
+#if defined(BTC27_SIMD_X86)
+// Collapse each 8 byte lane of x (symbols already masked to bitln bits)
+// into its low 8*bitln bits: pairs of bytes, then pairs of 16 bit fields,
+// then pairs of 32 bit fields are merged with shifts.
+BTC27_TARGET_SSE42 static inline __m128i btcmpctr_packLanes_sse42(__m128i x, unsigned int bitln)
+{
+    x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi16(0x00FF)),
+                     _mm_sll_epi16(_mm_srli_epi16(x, 8), _mm_cvtsi32_si128(bitln)));
+    x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi32(0x0000FFFF)),
+                     _mm_sll_epi32(_mm_srli_epi32(x, 16), _mm_cvtsi32_si128(2*bitln)));
+    x = _mm_or_si128(_mm_and_si128(x, _mm_set_epi32(0, -1, 0, -1)),
+                     _mm_sll_epi64(_mm_srli_epi64(x, 32), _mm_cvtsi32_si128(4*bitln)));
+    return x;
+}
+
+BTC27_TARGET_SSE42 static void btcmpctr_pack64B_sse42(const unsigned char* syms,
+                                                     unsigned int         bitln,
+                                                     unsigned char*       outBuf
+                                                    )
+{
+    const __m128i mask = _mm_set1_epi8((char)((1 << bitln) - 1));
+    for(int j = 0; j < 4; j++) {
+        __m128i x = _mm_and_si128(_mm_loadu_si128((const __m128i*)(syms + 16*j)), mask);
+        x = btcmpctr_packLanes_sse42(x, bitln);
+        // Lanes overlap in the output; later stores overwrite the unused upper bytes.
+        uint64_t lo = (uint64_t)_mm_cvtsi128_si64(x);
+        uint64_t hi = (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(x, x));
+        memcpy(outBuf + (2*j)*bitln, &lo, sizeof(lo));
+        memcpy(outBuf + (2*j+1)*bitln, &hi, sizeof(hi));
+    }
+}
+
+BTC27_TARGET_SSE42 static uint64_t btcmpctr_packBitmap64B_sse42(const unsigned char* bitmap)
+{
+    uint64_t word = 0;
+    for(int j = 0; j < 4; j++) {
+        // Move bit 0 of each byte to bit 7 and gather with movemask.
+        __m128i x = _mm_slli_epi64(_mm_loadu_si128((const __m128i*)(bitmap + 16*j)), 7);
+        word |= (uint64_t)(unsigned int)_mm_movemask_epi8(x) << (16*j);
+    }
+    return word;
+}
+
+// Broadcast each byte of the word to 8 bytes and test one bit in each.
+BTC27_TARGET_SSE42 static void btcmpctr_unpackBitmap64B_sse42(uint64_t word, unsigned char* bitmap)
+{
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+    const __m128i bitSel = _mm_set1_epi64x((long long)0x8040201008040201ULL);
+    for(int j = 0; j < 4; j++) {
+        __m128i x = _mm_shuffle_epi8(_mm_cvtsi32_si128((int)(word >> (16*j))), spread);
+        x = _mm_cmpeq_epi8(_mm_and_si128(x, bitSel), bitSel);
+        _mm_storeu_si128((__m128i*)(bitmap + 16*j), _mm_and_si128(x, _mm_set1_epi8(1)));
+    }
+}
+
+// Inverse of btcmpctr_packLanes_sse42: spread the low 8*BITLN bits of each
+// 8 byte lane to one BITLN bit symbol per byte, halving the fields at
+// every step.
+template <unsigned int BITLN>
+BTC27_TARGET_SSE42 static inline __m128i btcmpctr_unpackLanes_sse42(__m128i x)
+{
+    const __m128i m4 = _mm_set1_epi64x((1LL << (4*BITLN)) - 1);
+    const __m128i m2 = _mm_set1_epi32((1 << (2*BITLN)) - 1);
+    const __m128i m1 = _mm_set1_epi16((short)((1 << BITLN) - 1));
+    x = _mm_or_si128(_mm_and_si128(x, m4), _mm_slli_epi64(_mm_and_si128(_mm_srli_epi64(x, 4*BITLN), m4), 32));
+    x = _mm_or_si128(_mm_and_si128(x, m2), _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(x, 2*BITLN), m2), 16));
+    x = _mm_or_si128(_mm_and_si128(x, m1), _mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(x, BITLN), m1), 8));
+    return x;
+}
+
+// Byte shuffle placing the lanes at byte offsets 0 and BITLN of a 16 byte
+// load in the low and high halves of the vector.
+template <unsigned int BITLN>
+BTC27_TARGET_SSE42 static inline __m128i btcmpctr_unpackShuffle_sse42()
+{
+    return _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                         BITLN, BITLN+1, BITLN+2, BITLN+3, BITLN+4, BITLN+5, BITLN+6, BITLN+7);
+}
+
+// Table lookup of BITLN bit indices. Up to 16 entries is a single byte
+// shuffle; up to 64 entries shuffles the 4 LSBs into every quarter of the
+// table and selects on index bits 4 and 5, moved to the byte MSBs.
+template <unsigned int BITLN>
+BTC27_TARGET_SSE42 static inline __m128i btcmpctr_lookup_sse42(__m128i x, const unsigned char* lut)
+{
+    __m128i r0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)lut), x);
+    if (BITLN <= 4) {
+        return r0;
+    }
+    __m128i r1  = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(lut + 16)), x);
+    __m128i r2  = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(lut + 32)), x);
+    __m128i r3  = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(lut + 48)), x);
+    __m128i sel4 = _mm_slli_epi16(x, 3);
+    __m128i sel5 = _mm_slli_epi16(x, 2);
+    return _mm_blendv_epi8(_mm_blendv_epi8(r0, r1, sel4), _mm_blendv_epi8(r2, r3, sel4), sel5);
+}
+
+// Transform of the unpacked symbols, see btcmpctr_xfrmSym.
+template <unsigned int BITLN, int XFRM>
+BTC27_TARGET_SSE42 static inline __m128i btcmpctr_xfrm_sse42(__m128i x, const unsigned char* xfrmArg)
+{
+    if (XFRM == BTC27_XFRM_LOOKUP) {
+        x = btcmpctr_lookup_sse42<BITLN>(x, xfrmArg);
+    }
+    if ((XFRM == BTC27_XFRM_SIGNED) || (XFRM == BTC27_XFRM_SIGNED_ADD)) {
+        // (x >> 1) ^ -(x & 1), there is no byte shift.
+        __m128i half = _mm_and_si128(_mm_srli_epi16(x, 1), _mm_set1_epi8(0x7F));
+        __m128i sign = _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(x, _mm_set1_epi8(1)));
+        x = _mm_xor_si128(half, sign);
+    }
+    if ((XFRM == BTC27_XFRM_ADD) || (XFRM == BTC27_XFRM_SIGNED_ADD)) {
+        x = _mm_add_epi8(x, _mm_set1_epi8((char)xfrmArg[0]));
+    }
+    return x;
+}
+
+template <unsigned int BITLN, int XFRM>
+BTC27_TARGET_SSE42 static void btcmpctr_unpack64B_sse42(const unsigned char* inBuf,
+                                                       const unsigned char* xfrmArg,
+                                                       unsigned char*       syms
+                                                      )
+{
+    const __m128i shuf = btcmpctr_unpackShuffle_sse42<BITLN>();
+    for(int j = 0; j < 4; j++) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(inBuf + 2*j*BITLN));
+        if (BITLN < 8) {
+            x = btcmpctr_unpackLanes_sse42<BITLN>(_mm_shuffle_epi8(x, shuf));
+        }
+        _mm_storeu_si128((__m128i*)(syms + 16*j), btcmpctr_xfrm_sse42<BITLN, XFRM>(x, xfrmArg));
+    }
+}
+
+BTC27_TARGET_AVX2 static void btcmpctr_pack64B_avx2(const unsigned char* syms,
+                                                   unsigned int         bitln,
+                                                   unsigned char*       outBuf
+                                                  )
+{
+    const __m256i mask = _mm256_set1_epi8((char)((1 << bitln) - 1));
+    const __m128i cnt1 = _mm_cvtsi32_si128(bitln);
+    const __m128i cnt2 = _mm_cvtsi32_si128(2*bitln);
+    const __m128i cnt4 = _mm_cvtsi32_si128(4*bitln);
+    for(int j = 0; j < 2; j++) {
+        __m256i x = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(syms + 32*j)), mask);
+        x = _mm256_or_si256(_mm256_and_si256(x, _mm256_set1_epi16(0x00FF)),
+                            _mm256_sll_epi16(_mm256_srli_epi16(x, 8), cnt1));
+        x = _mm256_or_si256(_mm256_and_si256(x, _mm256_set1_epi32(0x0000FFFF)),
+                            _mm256_sll_epi32(_mm256_srli_epi32(x, 16), cnt2));
+        x = _mm256_or_si256(_mm256_and_si256(x, _mm256_set1_epi64x(0xFFFFFFFFLL)),
+                            _mm256_sll_epi64(_mm256_srli_epi64(x, 32), cnt4));
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, x);
+        for(int i = 0; i < 4; i++) {
+            memcpy(outBuf + (4*j+i)*bitln, &lanes[i], sizeof(lanes[i]));
+        }
+    }
+}
+
+BTC27_TARGET_AVX2 static uint64_t btcmpctr_packBitmap64B_avx2(const unsigned char* bitmap)
+{
+    __m256i lo = _mm256_slli_epi64(_mm256_loadu_si256((const __m256i*)bitmap), 7);
+    __m256i hi = _mm256_slli_epi64(_mm256_loadu_si256((const __m256i*)(bitmap + 32)), 7);
+    return (uint64_t)(unsigned int)_mm256_movemask_epi8(lo) |
+           ((uint64_t)(unsigned int)_mm256_movemask_epi8(hi) << 32);
+}
+
+BTC27_TARGET_AVX2 static void btcmpctr_unpackBitmap64B_avx2(uint64_t word, unsigned char* bitmap)
+{
+    // Bytes 0,1 of each 32 bit half spread over the low 128 bits, bytes 2,3 over the high.
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bitSel = _mm256_set1_epi64x((long long)0x8040201008040201ULL);
+    for(int j = 0; j < 2; j++) {
+        __m256i x = _mm256_shuffle_epi8(_mm256_set1_epi32((int)(word >> (32*j))), spread);
+        x = _mm256_cmpeq_epi8(_mm256_and_si256(x, bitSel), bitSel);
+        _mm256_storeu_si256((__m256i*)(bitmap + 32*j), _mm256_and_si256(x, _mm256_set1_epi8(1)));
+    }
+}
+
+template <unsigned int BITLN>
+BTC27_TARGET_AVX2 static inline __m256i btcmpctr_lookup_avx2(__m256i x, const unsigned char* lut)
+{
+    __m256i r0 = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lut)), x);
+    if (BITLN <= 4) {
+        return r0;
+    }
+    __m256i r1  = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut + 16))), x);
+    __m256i r2  = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut + 32))), x);
+    __m256i r3  = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut + 48))), x);
+    __m256i sel4 = _mm256_slli_epi16(x, 3);
+    __m256i sel5 = _mm256_slli_epi16(x, 2);
+    return _mm256_blendv_epi8(_mm256_blendv_epi8(r0, r1, sel4), _mm256_blendv_epi8(r2, r3, sel4), sel5);
+}
+
+template <unsigned int BITLN, int XFRM>
+BTC27_TARGET_AVX2 static inline __m256i btcmpctr_xfrm_avx2(__m256i x, const unsigned char* xfrmArg)
+{
+    if (XFRM == BTC27_XFRM_LOOKUP) {
+        x = btcmpctr_lookup_avx2<BITLN>(x, xfrmArg);
+    }
+    if ((XFRM == BTC27_XFRM_SIGNED) || (XFRM == BTC27_XFRM_SIGNED_ADD)) {
+        __m256i half = _mm256_and_si256(_mm256_srli_epi16(x, 1), _mm256_set1_epi8(0x7F));
+        __m256i sign = _mm256_sub_epi8(_mm256_setzero_si256(), _mm256_and_si256(x, _mm256_set1_epi8(1)));
+        x = _mm256_xor_si256(half, sign);
+    }
+    if ((XFRM == BTC27_XFRM_ADD) || (XFRM == BTC27_XFRM_SIGNED_ADD)) {
+        x = _mm256_add_epi8(x, _mm256_set1_epi8((char)xfrmArg[0]));
+    }
+    return x;
+}
+
+template <unsigned int BITLN, int XFRM>
+BTC27_TARGET_AVX2 static void btcmpctr_unpack64B_avx2(const unsigned char* inBuf,
+                                                     const unsigned char* xfrmArg,
+                                                     unsigned char*       syms
+                                                    )
+{
+    const __m256i shuf = _mm256_broadcastsi128_si256(btcmpctr_unpackShuffle_sse42<BITLN>());
+    const __m256i m4 = _mm256_set1_epi64x((1LL << (4*BITLN)) - 1);
+    const __m256i m2 = _mm256_set1_epi32((1 << (2*BITLN)) - 1);
+    const __m256i m1 = _mm256_set1_epi16((short)((1 << BITLN) - 1));
+    for(int j = 0; j < 2; j++) {
+        // Lanes 0,1 in the low half and lanes 2,3 in the high half.
+        const unsigned char* in = inBuf + 4*j*BITLN;
+        __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)in)),
+                                            _mm_loadu_si128((const __m128i*)(in + 2*BITLN)), 1);
+        if (BITLN < 8) {
+            x = _mm256_shuffle_epi8(x, shuf);
+            x = _mm256_or_si256(_mm256_and_si256(x, m4), _mm256_slli_epi64(_mm256_and_si256(_mm256_srli_epi64(x, 4*BITLN), m4), 32));
+            x = _mm256_or_si256(_mm256_and_si256(x, m2), _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(x, 2*BITLN), m2), 16));
+            x = _mm256_or_si256(_mm256_and_si256(x, m1), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(x, BITLN), m1), 8));
+        }
+        _mm256_storeu_si256((__m256i*)(syms + 32*j), btcmpctr_xfrm_avx2<BITLN, XFRM>(x, xfrmArg));
+    }
+}
+
+// GCC 12 warns about the undefined pass-through operand inside the AVX-512 intrinsics.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+BTC27_TARGET_AVX512 static void btcmpctr_pack64B_avx512(const unsigned char* syms,
+                                                       unsigned int         bitln,
+                                                       unsigned char*       outBuf
+                                                      )
+{
+    // The 64 symbols are a single vector, same lane merging as the SSE4.2 kernel.
+    __m512i x = _mm512_and_si512(_mm512_loadu_si512(syms), _mm512_set1_epi8((char)((1 << bitln) - 1)));
+    x = _mm512_or_si512(_mm512_and_si512(x, _mm512_set1_epi16(0x00FF)),
+                        _mm512_sll_epi16(_mm512_srli_epi16(x, 8), _mm_cvtsi32_si128(bitln)));
+    x = _mm512_or_si512(_mm512_and_si512(x, _mm512_set1_epi32(0x0000FFFF)),
+                        _mm512_sll_epi32(_mm512_srli_epi32(x, 16), _mm_cvtsi32_si128(2*bitln)));
+    x = _mm512_or_si512(_mm512_and_si512(x, _mm512_set1_epi64(0xFFFFFFFFLL)),
+                        _mm512_sll_epi64(_mm512_srli_epi64(x, 32), _mm_cvtsi32_si128(4*bitln)));
+    uint64_t lanes[8];
+    _mm512_storeu_si512(lanes, x);
+    for(int i = 0; i < 8; i++) {
+        memcpy(outBuf + i*bitln, &lanes[i], sizeof(lanes[i]));
+    }
+}
+
+BTC27_TARGET_AVX512 static uint64_t btcmpctr_packBitmap64B_avx512(const unsigned char* bitmap)
+{
+    return (uint64_t)_mm512_test_epi8_mask(_mm512_loadu_si512(bitmap), _mm512_set1_epi8(1));
+}
+
+BTC27_TARGET_AVX512 static void btcmpctr_unpackBitmap64B_avx512(uint64_t word, unsigned char* bitmap)
+{
+    _mm512_storeu_si512(bitmap, _mm512_maskz_mov_epi8((__mmask64)word, _mm512_set1_epi8(1)));
+}
+
+template <unsigned int BITLN>
+BTC27_TARGET_AVX512 static inline __m512i btcmpctr_unpackBlock_avx512(const unsigned char* inBuf)
+{
+    // Two lanes per 128 bit quarter, the whole block is a single vector.
+    __m512i x = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i*)inBuf));
+    x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*)(inBuf + 2*BITLN)), 1);
+    x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*)(inBuf + 4*BITLN)), 2);
+    x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*)(inBuf + 6*BITLN)), 3);
+    if (BITLN == 8) {
+        return x;
+    }
+    x = _mm512_shuffle_epi8(x, _mm512_broadcast_i32x4(btcmpctr_unpackShuffle_sse42<BITLN>()));
+    const __m512i m4 = _mm512_set1_epi64((1LL << (4*BITLN)) - 1);
+    const __m512i m2 = _mm512_set1_epi32((1 << (2*BITLN)) - 1);
+    const __m512i m1 = _mm512_set1_epi16((short)((1 << BITLN) - 1));
+    x = _mm512_or_si512(_mm512_and_si512(x, m4), _mm512_slli_epi64(_mm512_and_si512(_mm512_srli_epi64(x, 4*BITLN), m4), 32));
+    x = _mm512_or_si512(_mm512_and_si512(x, m2), _mm512_slli_epi32(_mm512_and_si512(_mm512_srli_epi32(x, 2*BITLN), m2), 16));
+    x = _mm512_or_si512(_mm512_and_si512(x, m1), _mm512_slli_epi16(_mm512_and_si512(_mm512_srli_epi16(x, BITLN), m1), 8));
+    return x;
+}
+
+template <unsigned int BITLN>
+BTC27_TARGET_AVX512 static inline __m512i btcmpctr_lookup_avx512(__m512i x, const unsigned char* lut)
+{
+    __m512i r0 = _mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)lut)), x);
+    if (BITLN <= 4) {
+        return r0;
+    }
+    __m512i r1 = _mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)(lut + 16))), x);
+    __m512i r2 = _mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)(lut + 32))), x);
+    __m512i r3 = _mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)(lut + 48))), x);
+    __mmask64 sel4 = _mm512_test_epi8_mask(x, _mm512_set1_epi8(16));
+    __mmask64 sel5 = _mm512_test_epi8_mask(x, _mm512_set1_epi8(32));
+    return _mm512_mask_blend_epi8(sel5, _mm512_mask_blend_epi8(sel4, r0, r1), _mm512_mask_blend_epi8(sel4, r2, r3));
+}
+
+template <unsigned int BITLN, int XFRM>
+BTC27_TARGET_AVX512 static inline __m512i btcmpctr_xfrm_avx512(__m512i x, const unsigned char* xfrmArg)
+{
+    if (XFRM == BTC27_XFRM_LOOKUP) {
+        x = btcmpctr_lookup_avx512<BITLN>(x, xfrmArg);
+    }
+    if ((XFRM == BTC27_XFRM_SIGNED) || (XFRM == BTC27_XFRM_SIGNED_ADD)) {
+        __m512i half = _mm512_and_si512(_mm512_srli_epi16(x, 1), _mm512_set1_epi8(0x7F));
+        __m512i sign = _mm512_sub_epi8(_mm512_setzero_si512(), _mm512_and_si512(x, _mm512_set1_epi8(1)));
+        x = _mm512_xor_si512(half, sign);
+    }
+    if ((XFRM == BTC27_XFRM_ADD) || (XFRM == BTC27_XFRM_SIGNED_ADD)) {
+        x = _mm512_add_epi8(x, _mm512_set1_epi8((char)xfrmArg[0]));
+    }
+    return x;
+}
+
+template <unsigned int BITLN, int XFRM>
+BTC27_TARGET_AVX512 static void btcmpctr_unpack64B_avx512(const unsigned char* inBuf,
+                                                         const unsigned char* xfrmArg,
+                                                         unsigned char*       syms
+                                                        )
+{
+    __m512i x = btcmpctr_unpackBlock_avx512<BITLN>(inBuf);
+    _mm512_storeu_si512(syms, btcmpctr_xfrm_avx512<BITLN, XFRM>(x, xfrmArg));
+}
+
+// The whole 64 entry table is a single byte permute, the other
+// transforms are the AVX-512 ones.
+template <unsigned int BITLN, int XFRM>
+BTC27_TARGET_AVX512_VBMI static void btcmpctr_unpack64B_avx512vbmi(const unsigned char* inBuf,
+                                                                  const unsigned char* xfrmArg,
+                                                                  unsigned char*       syms
+                                                                 )
+{
+    __m512i x = btcmpctr_unpackBlock_avx512<BITLN>(inBuf);
+    if (XFRM == BTC27_XFRM_LOOKUP) {
+        x = _mm512_permutexvar_epi8(x, _mm512_loadu_si512(xfrmArg));
+    } else {
+        x = btcmpctr_xfrm_avx512<BITLN, XFRM>(x, xfrmArg);
+    }
+    _mm512_storeu_si512(syms, x);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+//-----------------------------------------------------
+// Kernel selection
+//-----------------------------------------------------
+typedef void (*Pack64BKernel)(const unsigned char*, unsigned int, unsigned char*);
+typedef uint64_t (*PackBitmap64BKernel)(const unsigned char*);
+
+static Pack64BKernel btcmpctr_selectPack64B()
+{
+    switch(btcmpctr_cpuTier()) {
+#if defined(BTC27_SIMD_X86)
+        case BTC27_CPU_AVX512_VBMI:
+        case BTC27_CPU_AVX512: return btcmpctr_pack64B_avx512;
+        case BTC27_CPU_AVX2:   return btcmpctr_pack64B_avx2;
+        case BTC27_CPU_SSE42:  return btcmpctr_pack64B_sse42;
+#endif
+        default:               return btcmpctr_pack64B_scalar;
+    }
+}
+
+static PackBitmap64BKernel btcmpctr_selectPackBitmap64B()
+{
+    switch(btcmpctr_cpuTier()) {
+#if defined(BTC27_SIMD_X86)
+        case BTC27_CPU_AVX512_VBMI:
+        case BTC27_CPU_AVX512: return btcmpctr_packBitmap64B_avx512;
+        case BTC27_CPU_AVX2:   return btcmpctr_packBitmap64B_avx2;
+        case BTC27_CPU_SSE42:  return btcmpctr_packBitmap64B_sse42;
+#endif
+        default:               return btcmpctr_packBitmap64B_scalar;
+    }
+}
+
+typedef void (*UnpackBitmap64BKernel)(uint64_t, unsigned char*);
+typedef void (*Unpack64BKernel)(const unsigned char*, const unsigned char*, unsigned char*);
+
+static UnpackBitmap64BKernel btcmpctr_selectUnpackBitmap64B()
+{
+    switch(btcmpctr_cpuTier()) {
+#if defined(BTC27_SIMD_X86)
+        case BTC27_CPU_AVX512_VBMI:
+        case BTC27_CPU_AVX512: return btcmpctr_unpackBitmap64B_avx512;
+        case BTC27_CPU_AVX2:   return btcmpctr_unpackBitmap64B_avx2;
+        case BTC27_CPU_SSE42:  return btcmpctr_unpackBitmap64B_sse42;
+#endif
+        default:               return btcmpctr_unpackBitmap64B_scalar;
+    }
+}
+
+// Unpack kernels, indexed by [xfrm][bitln - 1]. Lookups only exist up to
+// BTC27_LOOKUP_MAXBITLN.
+typedef Unpack64BKernel Unpack64BKernels[BTC27_NUMXFRM][8];
+
+#define BTC27_UNPACK64B_ROW(tier, xfrm) {                                      \
+    btcmpctr_unpack64B_##tier<1, xfrm>, btcmpctr_unpack64B_##tier<2, xfrm>,    \
+    btcmpctr_unpack64B_##tier<3, xfrm>, btcmpctr_unpack64B_##tier<4, xfrm>,    \
+    btcmpctr_unpack64B_##tier<5, xfrm>, btcmpctr_unpack64B_##tier<6, xfrm>,    \
+    btcmpctr_unpack64B_##tier<7, xfrm>, btcmpctr_unpack64B_##tier<8, xfrm> }
+
+#define BTC27_UNPACK64B_LOOKUP_ROW(tier) {                                                     \
+    btcmpctr_unpack64B_##tier<1, BTC27_XFRM_LOOKUP>, btcmpctr_unpack64B_##tier<2, BTC27_XFRM_LOOKUP>,  \
+    btcmpctr_unpack64B_##tier<3, BTC27_XFRM_LOOKUP>, btcmpctr_unpack64B_##tier<4, BTC27_XFRM_LOOKUP>,  \
+    btcmpctr_unpack64B_##tier<5, BTC27_XFRM_LOOKUP>, btcmpctr_unpack64B_##tier<6, BTC27_XFRM_LOOKUP>,  \
+    nullptr, nullptr }
+
+#define BTC27_UNPACK64B_TABLE(tier) {                   \
+    BTC27_UNPACK64B_ROW(tier, BTC27_XFRM_NONE),         \
+    BTC27_UNPACK64B_LOOKUP_ROW(tier),                   \
+    BTC27_UNPACK64B_ROW(tier, BTC27_XFRM_SIGNED),       \
+    BTC27_UNPACK64B_ROW(tier, BTC27_XFRM_ADD),          \
+    BTC27_UNPACK64B_ROW(tier, BTC27_XFRM_SIGNED_ADD) }
+
+static const Unpack64BKernels& btcmpctr_selectUnpack64B()
+{
+    static const Unpack64BKernels scalarKernels = BTC27_UNPACK64B_TABLE(scalar);
+#if defined(BTC27_SIMD_X86)
+    static const Unpack64BKernels sse42Kernels  = BTC27_UNPACK64B_TABLE(sse42);
+    static const Unpack64BKernels avx2Kernels   = BTC27_UNPACK64B_TABLE(avx2);
+    static const Unpack64BKernels avx512Kernels = BTC27_UNPACK64B_TABLE(avx512);
+    static const Unpack64BKernels vbmiKernels   = BTC27_UNPACK64B_TABLE(avx512vbmi);
+#endif
+    switch(btcmpctr_cpuTier()) {
+#if defined(BTC27_SIMD_X86)
+        case BTC27_CPU_AVX512_VBMI: return vbmiKernels;
+        case BTC27_CPU_AVX512:      return avx512Kernels;
+        case BTC27_CPU_AVX2:        return avx2Kernels;
+        case BTC27_CPU_SSE42:       return sse42Kernels;
+#endif
+        default:                    return scalarKernels;
+    }
+}
+
+void btcmpctr_pack64B(const unsigned char* syms,
+                      unsigned int         bitln,
+                      unsigned char*       outBuf
+                     )
+{
+    static const Pack64BKernel kernel = btcmpctr_selectPack64B();
+    if (bitln == 8) {
+        memcpy(outBuf, syms, 64);
+        return;
+    }
+    kernel(syms, bitln, outBuf);
+}
+
+uint64_t btcmpctr_packBitmap64B(const unsigned char* bitmap)
+{
+    static const PackBitmap64BKernel kernel = btcmpctr_selectPackBitmap64B();
+    return kernel(bitmap);
+}
+
+void btcmpctr_unpackBitmap64B(uint64_t word, unsigned char* bitmap)
+{
+    static const UnpackBitmap64BKernel kernel = btcmpctr_selectUnpackBitmap64B();
+    kernel(word, bitmap);
+}
+
+void btcmpctr_unpack64B(const unsigned char* inBuf,
+                        unsigned int         bitln,
+                        unsigned char*       syms
+                       )
+{
+    btcmpctr_unpackXfrm64B(inBuf, bitln, BTC27_XFRM_NONE, nullptr, syms);
+}
+
+void btcmpctr_unpackXfrm64B(const unsigned char* inBuf,
+                            unsigned int         bitln,
+                            int                  xfrm,
+                            const unsigned char* xfrmArg,
+                            unsigned char*       syms
+                           )
+{
+    static const Unpack64BKernels& kernels = btcmpctr_selectUnpack64B();
+    kernels[xfrm][bitln - 1](inBuf, xfrmArg, syms);
+}
+
+void btcmpctr_unpackXfrm64B_scalar(const unsigned char* inBuf,
+                                   unsigned int         bitln,
+                                   int                  xfrm,
+                                   const unsigned char* xfrmArg,
+                                   unsigned char*       syms
+                                  )
+{
+    static const Unpack64BKernels kernels = BTC27_UNPACK64B_TABLE(scalar);
+    kernels[xfrm][bitln - 1](inBuf, xfrmArg, syms);
+}
+
+} // namespace btc27
@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2023 Intel Corporation
+// SPDX-License-Identifier: Apache 2.0
+//
+
+//
+
+// CPU feature detection for the kernel dispatch.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include "cpuDispatch.h"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace btc27
+{
+
+int btcmpctr_cpuTierDetected()
+{
+    int tier = BTC27_CPU_SCALAR;
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+    // __builtin_cpu_supports also checks that the OS saves the AVX/AVX-512 state.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        tier = BTC27_CPU_SSE42;
+        if (__builtin_cpu_supports("avx2")) {
+            tier = BTC27_CPU_AVX2;
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+                tier = BTC27_CPU_AVX512;
+                if (__builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512vbmi2")) {
+                    tier = BTC27_CPU_AVX512_VBMI;
+                }
+            }
+        }
+    }
+#elif defined(_MSC_VER) && defined(_M_X64)
+    int regs[4];
+    __cpuid(regs, 1);
+    const bool sse42   = (regs[2] >> 20) & 1;
+    const bool popcnt  = (regs[2] >> 23) & 1;
+    const bool osxsave = (regs[2] >> 27) & 1;
+    if (sse42 && popcnt) {
+        tier = BTC27_CPU_SSE42;
+        unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        __cpuidex(regs, 7, 0);
+        if (((xcr0 & 0x06) == 0x06) && ((regs[1] >> 5) & 1)) {
+            tier = BTC27_CPU_AVX2;
+            if (((xcr0 & 0xE6) == 0xE6) && ((regs[1] >> 16) & 1) && ((regs[1] >> 30) & 1)) {
+                tier = BTC27_CPU_AVX512;
+                if (((regs[2] >> 1) & 1) && ((regs[2] >> 6) & 1)) {
+                    tier = BTC27_CPU_AVX512_VBMI;
+                }
+            }
+        }
+    }
+#endif
+    return tier;
+}
+
+const char* btcmpctr_cpuTierName(int tier)
+{
+    switch(tier) {
+        case BTC27_CPU_SSE42:  return "sse42";
+        case BTC27_CPU_AVX2:   return "avx2";
+        case BTC27_CPU_AVX512: return "avx512";
+        case BTC27_CPU_AVX512_VBMI: return "avx512vbmi";
+        default:               return "scalar";
+    }
+}
+
+static int btcmpctr_selectCpuTier()
+{
+    int tier = btcmpctr_cpuTierDetected();
+    const char* env = std::getenv(BTC27_CPU_TIER_ENV);
+    if (env) {
+        // A tier above the detected one is not honoured.
+        for(int t = BTC27_CPU_SCALAR; t < tier; t++) {
+            if (!std::strcmp(env, btcmpctr_cpuTierName(t))) {
+                tier = t;
+                break;
+            }
+        }
+    }
+    return tier;
+}
+
+int btcmpctr_cpuTier()
+{
+    static const int tier = btcmpctr_selectCpuTier();
+    return tier;
+}
+
+// Select the tier when the library is loaded rather than on the first call.
+static const int sCpuTierAtLoad = btcmpctr_cpuTier();
+
+} // namespace btc27
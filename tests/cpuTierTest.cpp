@@ -0,0 +1,469 @@
+//
+// Copyright (C) 2023 Intel Corporation
+// SPDX-License-Identifier: Apache 2.0
+//
+
+//
+
+// Runs a fixed set of inputs through every compression and decompression
+// entry point and collects the outputs. Run with --write under
+// BTC27_CPU_TIER=scalar to store them, then with --check under the other
+// tiers to compare them byte for byte.
+// With --golden, compresses a few inputs and compares the streams with
+// golden ones written by the original encoder, and decompresses the golden
+// streams. --write-golden rewrites them, only for a deliberate format change.
+// Usage: bit_compactor_cpu_tier_test --write|--check|--golden|--write-golden <file>
+//
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "bitCompactor.h"
+#include "cpuDispatch.h"
+
+using namespace btc27;
+
+typedef BitCompactor::btcmpctr_compress_wrap_args_t btcmpctr_compress_wrap_args_t;
+typedef BitCompactor::btcmpctr_dequant_args_t       btcmpctr_dequant_args_t;
+typedef BitCompactor::btcmpctr_block_info_t         btcmpctr_block_info_t;
+
+// Not a multiple of the 64B or 4K block size, so that the last block is short.
+#define TEST_BUFSIZE   (3*4096 + 5*64 + 37)
+#define TEST_NUMINPUTS 8
+// Header Algo of the bitmap pre-processing
+#define TEST_BTEXPPROC 6
+
+static int sFailures = 0;
+
+static void fail(const char* what, int input, int cfg)
+{
+    printf("FAIL: %s, input %d, configuration %d\n", what, input, cfg);
+    sFailures++;
+}
+
+static unsigned int lcg(unsigned int& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+}
+
+// Inputs exercising the different Algos: random bytes, narrow ranges,
+// sparse and repetitive data, int8 weights, few distinct symbols.
+static void genInput(int kind, std::vector<unsigned char>& buf)
+{
+    unsigned int state = 12345u + kind;
+    buf.resize(TEST_BUFSIZE);
+    for(unsigned int i = 0; i < buf.size(); i++) {
+        unsigned int r = lcg(state);
+        switch(kind) {
+            case 0:  buf[i] = r; break;
+            case 1:  buf[i] = 100 + (r % 13); break;
+            case 2:  buf[i] = ((r % 16) == 0) ? (r >> 8) : 0; break;
+            case 3:  buf[i] = (i / 4096) + ((i % 64) < 48 ? 0 : (r % 4)); break;
+            case 4:  buf[i] = (unsigned char)(signed char)(((int)(r % 31) + (int)((r >> 5) % 31) - 30) / 2); break;
+            case 5:  { static const unsigned char syms[5] = {3, 17, 90, 201, 255}; buf[i] = syms[r % 5]; } break;
+            case 6:  buf[i] = ((i / 512) & 1) ? 0x5A : (r % 4); break;
+            default: buf[i] = (i & 63) ^ (r % 2); break;
+        }
+    }
+}
+
+static void append(std::vector<unsigned char>& out, const void* data, unsigned int size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+static void runCase(int input, int cfg, const std::vector<unsigned char>& src,
+                    const btcmpctr_compress_wrap_args_t& args,
+                    bool dequantize, std::vector<unsigned char>& out)
+{
+    BitCompactor btc;
+    const unsigned int srcLen = src.size();
+
+    std::vector<unsigned char> cmp(btc.GetCompressedSizeBound(srcLen) + BTC27_DECODE_PADDING);
+    unsigned int cmpLen = cmp.size() - BTC27_DECODE_PADDING;
+    if (!btc.CompressWrap(src.data(), srcLen, cmp.data(), cmpLen, args)) {
+        fail("CompressWrap", input, cfg);
+        return;
+    }
+    append(out, &cmpLen, sizeof(cmpLen));
+    append(out, cmp.data(), cmpLen);
+
+    std::vector<unsigned char> dec(srcLen);
+    unsigned int decLen = srcLen;
+    if (!btc.DecompressWrap(cmp.data(), cmpLen, dec.data(), decLen, args)) {
+        fail("DecompressWrap", input, cfg);
+        return;
+    }
+    append(out, &decLen, sizeof(decLen));
+    append(out, dec.data(), decLen);
+    if ((decLen != srcLen) || memcmp(dec.data(), src.data(), srcLen)) {
+        fail("round trip", input, cfg);
+    }
+
+    std::vector<unsigned char> decPadded(srcLen);
+    unsigned int decPaddedLen = srcLen;
+    if ((btc.DecompressPaddedWrap(cmp.data(), cmpLen, decPadded.data(), decPaddedLen, args) != BTC27_DECODE_OK) ||
+        (decPaddedLen != decLen) || memcmp(decPadded.data(), dec.data(), decLen)) {
+        fail("DecompressPaddedWrap", input, cfg);
+    }
+
+    unsigned int scanLen = 0;
+    unsigned int numBlocks = 0;
+    if (!btc.ScanWrap(cmp.data(), cmpLen, scanLen, nullptr, numBlocks, args) || (scanLen != decLen)) {
+        fail("ScanWrap without block map", input, cfg);
+    }
+    std::vector<btcmpctr_block_info_t> blocks(numBlocks);
+    if (!btc.ScanWrap(cmp.data(), cmpLen, scanLen, blocks.data(), numBlocks, args) || (scanLen != decLen)) {
+        fail("ScanWrap", input, cfg);
+    }
+    for(unsigned int b = 0; b < blocks.size(); b++) {
+        append(out, &blocks[b].bitOffset, sizeof(blocks[b].bitOffset));
+        append(out, &blocks[b].blkSize, sizeof(blocks[b].blkSize));
+        append(out, &blocks[b].algo, sizeof(blocks[b].algo));
+        append(out, &blocks[b].bitln, sizeof(blocks[b].bitln));
+    }
+
+    if (!dequantize) {
+        return;
+    }
+
+    // Per channel dequantization, including a channel last layout
+    // (channelStride 1), strides not dividing the block size and a channel
+    // period longer than a block.
+    static const unsigned int dequantShapes[4][2] = {{3, 1}, {5, 7}, {2, 1152}, {5000, 4}};
+    std::vector<float> scale(5000);
+    std::vector<float> zeroPoint(5000);
+    for(int c = 0; c < 5000; c++) {
+        scale[c]     = 0.0125f * (c % 11 + 1);
+        zeroPoint[c] = (float)(c % 7 * 3 - 4);
+    }
+    for(int s = 0; s < 4; s++) {
+        btcmpctr_dequant_args_t dequant;
+        dequant.scale         = scale.data();
+        dequant.zeroPoint     = (s == 1) ? nullptr : zeroPoint.data();
+        dequant.numChannels   = dequantShapes[s][0];
+        dequant.channelStride = dequantShapes[s][1];
+        dequant.isSigned      = (input + s) & 1;
+
+        std::vector<float> f32(srcLen);
+        unsigned int f32Len = srcLen;
+        if (!btc.DecompressDequantWrap(cmp.data(), cmpLen, f32.data(), f32Len, dequant, args) || (f32Len != decLen)) {
+            fail("DecompressDequantWrap fp32", input, cfg);
+            continue;
+        }
+        append(out, f32.data(), f32Len * sizeof(float));
+
+        std::vector<uint16_t> f16(srcLen);
+        unsigned int f16Len = srcLen;
+        if (!btc.DecompressDequantWrap(cmp.data(), cmpLen, f16.data(), f16Len, dequant, args) || (f16Len != decLen)) {
+            fail("DecompressDequantWrap fp16", input, cfg);
+            continue;
+        }
+        append(out, f16.data(), f16Len * sizeof(uint16_t));
+    }
+}
+
+// 4K blocks with the bitmap pre-processing (BTEXPPROC) used to be written
+// with 1 bit per byte other than the top symbol, and never decoded.
+static void genBitmap4KInput(std::vector<unsigned char>& src)
+{
+    src.resize(2*4096 + 100);
+    unsigned int state = 777u;
+    for(unsigned int i = 0; i < src.size(); i++) {
+        unsigned int r = lcg(state);
+        src[i] = ((r % 40) == 0) ? (r >> 8) : 0x80;
+    }
+}
+
+static void checkBitmap4K()
+{
+    std::vector<unsigned char> src;
+    genBitmap4KInput(src);
+    for(int dual = 0; dual < 2; dual++) {
+        btcmpctr_compress_wrap_args_t args;
+        args.mixedBlkSize   = 1;
+        args.proc_btmap_en  = 1;
+        args.dual_encode_en = dual;
+
+        BitCompactor btc;
+        std::vector<unsigned char> cmp(btc.GetCompressedSizeBound(src.size()));
+        unsigned int cmpLen = cmp.size();
+        if (!btc.CompressWrap(src.data(), src.size(), cmp.data(), cmpLen, args)) {
+            fail("bitmap 4K CompressWrap", -1, dual);
+            continue;
+        }
+        btcmpctr_block_info_t blocks[4];
+        unsigned int numBlocks = 4;
+        unsigned int scanLen = 0;
+        if (!btc.ScanWrap(cmp.data(), cmpLen, scanLen, blocks, numBlocks, args) || (numBlocks < 2) ||
+            (blocks[0].blkSize != 4096) || (blocks[0].algo != TEST_BTEXPPROC)) {
+            fail("bitmap 4K block choice", -1, dual);
+        }
+        std::vector<unsigned char> dec(src.size());
+        unsigned int decLen = dec.size();
+        if (!btc.DecompressWrap(cmp.data(), cmpLen, dec.data(), decLen, args) ||
+            (decLen != src.size()) || memcmp(dec.data(), src.data(), decLen)) {
+            fail("bitmap 4K round trip", -1, dual);
+        }
+    }
+}
+
+// Golden streams: prefixes of some of the inputs, with a 4K block, through
+// configurations covering the stream layouts. Default level.
+#define GOLDEN_BUFSIZE (4096 + 2*64 + 37)
+static const int goldenInputs[4] = {1, 2, 4, 5};
+static const int goldenCfgs[6][5] = {
+    // mixedBlkSize, dual_encode_en, proc_bin_en, bypass_en, align
+    {0, 1, 0, 0, 1},
+    {0, 0, 0, 0, 1},
+    {1, 1, 0, 0, 1},
+    {1, 0, 0, 0, 1},
+    {1, 1, 1, 0, 0},
+    {0, 1, 0, 1, 2}
+};
+
+static void runGolden(const char* path, bool write)
+{
+    FILE* f = fopen(path, write ? "wb" : "rb");
+    if (!f) {
+        printf("FAIL: cannot open %s\n", path);
+        sFailures++;
+        return;
+    }
+    std::vector<unsigned char> src;
+    for(int n = 0; n < 4; n++) {
+        genInput(goldenInputs[n], src);
+        src.resize(GOLDEN_BUFSIZE);
+        for(int c = 0; c < 6; c++) {
+            btcmpctr_compress_wrap_args_t args;
+            args.mixedBlkSize   = goldenCfgs[c][0];
+            args.dual_encode_en = goldenCfgs[c][1];
+            args.proc_bin_en    = goldenCfgs[c][2];
+            args.bypass_en      = goldenCfgs[c][3];
+            args.align          = goldenCfgs[c][4];
+
+            BitCompactor btc;
+            std::vector<unsigned char> cmp(btc.GetCompressedSizeBound(src.size()));
+            unsigned int cmpLen = cmp.size();
+            if (!btc.CompressWrap(src.data(), src.size(), cmp.data(), cmpLen, args)) {
+                fail("golden CompressWrap", goldenInputs[n], c);
+                continue;
+            }
+            if (write) {
+                if ((fwrite(&cmpLen, sizeof(cmpLen), 1, f) != 1) || (fwrite(cmp.data(), 1, cmpLen, f) != cmpLen)) {
+                    fail("writing the golden stream", goldenInputs[n], c);
+                }
+                continue;
+            }
+            unsigned int goldenLen = 0;
+            if (fread(&goldenLen, sizeof(goldenLen), 1, f) != 1) {
+                fail("reading the golden stream", goldenInputs[n], c);
+                fclose(f);
+                return;
+            }
+            std::vector<unsigned char> golden(goldenLen);
+            if (fread(golden.data(), 1, goldenLen, f) != goldenLen) {
+                fail("reading the golden stream", goldenInputs[n], c);
+                fclose(f);
+                return;
+            }
+            if ((cmpLen != goldenLen) || memcmp(cmp.data(), golden.data(), goldenLen)) {
+                fail("golden stream", goldenInputs[n], c);
+            }
+            std::vector<unsigned char> dec(src.size());
+            unsigned int decLen = dec.size();
+            if (!btc.DecompressWrap(golden.data(), goldenLen, dec.data(), decLen, args) ||
+                (decLen != src.size()) || memcmp(dec.data(), src.data(), decLen)) {
+                fail("golden stream decompression", goldenInputs[n], c);
+            }
+        }
+    }
+    if (!write && (fgetc(f) != EOF)) {
+        printf("FAIL: %s has more streams than expected\n", path);
+        sFailures++;
+    }
+    fclose(f);
+}
+
+static void checkStatus(const char* what, int status, int expected)
+{
+    if (status != expected) {
+        printf("FAIL: %s, status %d instead of %d\n", what, status, expected);
+        sFailures++;
+    }
+}
+
+// Truncated and corrupted streams, the status codes of DecompressPaddedWrap
+// and the ScanWrap failures.
+static void checkMalformed()
+{
+    BitCompactor btc;
+    std::vector<unsigned char> src;
+    genInput(1, src);
+    btcmpctr_compress_wrap_args_t args;
+    std::vector<unsigned char> cmp(btc.GetCompressedSizeBound(src.size()) + BTC27_DECODE_PADDING);
+    unsigned int cmpLen = cmp.size() - BTC27_DECODE_PADDING;
+    std::vector<btcmpctr_block_info_t> blocks(src.size() / 64 + 2);
+    unsigned int numBlocks = blocks.size();
+    unsigned int scanLen = 0;
+    if (!btc.CompressWrap(src.data(), src.size(), cmp.data(), cmpLen, args) ||
+        !btc.ScanWrap(cmp.data(), cmpLen, scanLen, blocks.data(), numBlocks, args) || (numBlocks < 4)) {
+        fail("malformed stream setup", 1, 0);
+        return;
+    }
+    std::vector<unsigned char> dec(src.size());
+    unsigned int decLen = dec.size();
+
+    // Cut in the middle of the fourth block.
+    unsigned int truncLen = (unsigned int)(blocks[3].bitOffset / 8) + 2;
+    checkStatus("truncated stream", btc.DecompressPaddedWrap(cmp.data(), truncLen, dec.data(), decLen, args),
+                BTC27_DECODE_ERR_TRUNCATED);
+    if (btc.ScanWrap(cmp.data(), truncLen, scanLen, nullptr, numBlocks, args)) {
+        fail("ScanWrap of a truncated stream", 1, 0);
+    }
+    if (btc.DecompressWrap(cmp.data(), truncLen, dec.data(), decLen, args)) {
+        fail("DecompressWrap of a truncated stream", 1, 0);
+    }
+
+    decLen = src.size() - 1;
+    checkStatus("too small dst", btc.DecompressPaddedWrap(cmp.data(), cmpLen, dec.data(), decLen, args),
+                BTC27_DECODE_ERR_DST_SIZE);
+    decLen = dec.size();
+    checkStatus("null src", btc.DecompressPaddedWrap(nullptr, cmpLen, dec.data(), decLen, args),
+                BTC27_DECODE_ERR_NULL);
+    if (btc.ScanWrap(nullptr, cmpLen, scanLen, nullptr, numBlocks, args)) {
+        fail("ScanWrap of a null stream", 1, 0);
+    }
+
+    // A 4K BTEXPPROC block first. Without the dual encode field of
+    // BTC27_STREAM_V1, its header holds 2 bits of type, 2 of block size,
+    // 3 of Algo, 3 of bitln, 8 of top symbol, then numBytes in bits 18..31.
+    genBitmap4KInput(src);
+    args.mixedBlkSize  = 1;
+    args.proc_btmap_en = 1;
+    cmp.assign(btc.GetCompressedSizeBound(src.size()) + BTC27_DECODE_PADDING, 0);
+    cmpLen = cmp.size() - BTC27_DECODE_PADDING;
+    numBlocks = 1;
+    if (!btc.CompressWrap(src.data(), src.size(), cmp.data(), cmpLen, args) ||
+        !btc.ScanWrap(cmp.data(), cmpLen, scanLen, blocks.data(), numBlocks, args) ||
+        (blocks[0].algo != TEST_BTEXPPROC)) {
+        fail("malformed stream setup", -1, 1);
+        return;
+    }
+    dec.resize(src.size());
+    const unsigned int numBytes = (cmp[2] >> 2) | (cmp[3] << 6);
+    for(int corrupt = 0; corrupt < 2; corrupt++) {
+        // More bytes than symbols, then one byte less than the bitmap has set.
+        std::vector<unsigned char> bad(cmp);
+        unsigned int badBytes = corrupt ? (numBytes - 1) : 0x3FFF;
+        bad[2] = (bad[2] & 0x03) | (unsigned char)(badBytes << 2);
+        bad[3] = (unsigned char)(badBytes >> 6);
+        decLen = dec.size();
+        checkStatus(corrupt ? "bitmap not matching numBytes" : "numBytes above the block size",
+                    btc.DecompressPaddedWrap(bad.data(), cmpLen, dec.data(), decLen, args),
+                    BTC27_DECODE_ERR_MALFORMED);
+        if (!corrupt && btc.ScanWrap(bad.data(), cmpLen, scanLen, nullptr, numBlocks, args)) {
+            fail("ScanWrap of a block with too many bytes", -1, 1);
+        }
+    }
+}
+
+static void runAll(std::vector<unsigned char>& out)
+{
+    std::vector<unsigned char> src;
+    for(int input = 0; input < TEST_NUMINPUTS; input++) {
+        genInput(input, src);
+        int cfg = 0;
+        for(int dual = 1; dual >= 0; dual--) {
+            for(int mixed = 0; mixed < 2; mixed++) {
+                for(int procs = 0; procs < 4; procs++) {
+                    for(int level = BTC27_LEVEL_FAST; level <= BTC27_LEVEL_MAX; level++) {
+                        for(int adaptive = 0; adaptive < 2; adaptive++, cfg++) {
+                            if (adaptive && (level == BTC27_LEVEL_FAST)) {
+                                continue;
+                            }
+                            btcmpctr_compress_wrap_args_t args;
+                            args.dual_encode_en = dual;
+                            args.mixedBlkSize   = mixed;
+                            args.proc_bin_en    = procs & 1;
+                            args.proc_btmap_en  = procs >> 1;
+                            args.level          = level;
+                            args.adaptive_en    = adaptive;
+                            // The decompressed data is the same for every configuration.
+                            runCase(input, cfg, src, args, dual && !procs && (level == BTC27_LEVEL_MAX) && !adaptive, out);
+                        }
+                    }
+                }
+            }
+        }
+        // Bypass, every block uncompressed.
+        for(int mixed = 0; mixed < 2; mixed++, cfg++) {
+            btcmpctr_compress_wrap_args_t args;
+            args.mixedBlkSize = mixed;
+            args.bypass_en    = 1;
+            runCase(input, cfg, src, args, false, out);
+        }
+        // BTC27_STREAM_V1, compressed 4K blocks with the dual encode field.
+        for(int procs = 1; procs < 4; procs++, cfg++) {
+            btcmpctr_compress_wrap_args_t args;
+            args.mixedBlkSize  = 1;
+            args.proc_bin_en   = procs & 1;
+            args.proc_btmap_en = procs >> 1;
+            args.streamVersion = BTC27_STREAM_V1;
+            runCase(input, cfg, src, args, false, out);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc != 3) || (strcmp(argv[1], "--write") && strcmp(argv[1], "--check") &&
+                        strcmp(argv[1], "--golden") && strcmp(argv[1], "--write-golden"))) {
+        printf("Usage: %s --write|--check|--golden|--write-golden <file>\n", argv[0]);
+        return 2;
+    }
+    if (!strcmp(argv[1], "--golden") || !strcmp(argv[1], "--write-golden")) {
+        runGolden(argv[2], !strcmp(argv[1], "--write-golden"));
+        printf("%d failures\n", sFailures);
+        return sFailures ? 1 : 0;
+    }
+    const bool write = !strcmp(argv[1], "--write");
+    printf("CPU tier %s (detected %s)\n", btcmpctr_cpuTierName(btcmpctr_cpuTier()),
+                                          btcmpctr_cpuTierName(btcmpctr_cpuTierDetected()));
+
+    checkBitmap4K();
+    checkMalformed();
+    std::vector<unsigned char> out;
+    runAll(out);
+
+    FILE* f = fopen(argv[2], write ? "wb" : "rb");
+    if (!f) {
+        printf("FAIL: cannot open %s\n", argv[2]);
+        return 1;
+    }
+    if (write) {
+        if (fwrite(out.data(), 1, out.size(), f) != out.size()) {
+            fail("writing the reference", -1, -1);
+        }
+    } else {
+        std::vector<unsigned char> ref(out.size() + 1);
+        size_t refLen = fread(ref.data(), 1, ref.size(), f);
+        if (refLen != out.size()) {
+            printf("FAIL: %zu output bytes, %zu reference bytes\n", out.size(), refLen);
+            sFailures++;
+        } else if (memcmp(ref.data(), out.data(), out.size())) {
+            size_t i = 0;
+            while (ref[i] == out[i]) {
+                i++;
+            }
+            printf("FAIL: output differs from the reference at byte %zu\n", i);
+            sFailures++;
+        }
+    }
+    fclose(f);
+
+    printf("%zu output bytes, %d failures\n", out.size(), sFailures);
+    return sFailures ? 1 : 0;
+}